@@ -0,0 +1,464 @@
+"""Benchmarks for the Python <-> JavaScript bridge and the bundled compilers.
+
+Only needs the standard library and a built dukpy, so it runs offline::
+
+    python setup.py build_ext --inplace
+    python benchmarks/bench.py --json before.json
+    # ... change things, rebuild ...
+    python benchmarks/bench.py --json after.json
+    python benchmarks/bench.py --compare before.json after.json
+
+Each benchmark is calibrated to run for at least ``--min-time`` seconds
+per repeat and reports the per call time of every repeat; comparisons use
+the median.
+"""
+from __future__ import print_function
+
+import argparse
+import atexit
+import itertools
+import json
+import os
+import platform
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.dirname(HERE))
+
+import dukpy  # noqa: E402
+
+try:  # pragma: no cover
+    timer = time.perf_counter
+except AttributeError:  # pragma: no cover
+    timer = time.time
+
+SIZES = (10, 100, 1000)
+BENCHMARKS = []
+
+
+def bench(name, sizes=None):
+    """Registers a benchmark. The decorated function does the setup and
+    returns the callable to time; with ``sizes`` it's registered once for
+    each size and gets the size as its argument."""
+    def decorator(setup):
+        if sizes is None:
+            BENCHMARKS.append((name, setup))
+        else:
+            for size in sizes:
+                BENCHMARKS.append(('{0}[{1}]'.format(name, size),
+                                   lambda size=size: setup(size)))
+        return setup
+    return decorator
+
+
+# contexts and evaluation
+
+@bench('context_create')
+def bench_context_create():
+    return dukpy.Context
+
+
+@bench('eval_tiny')
+def bench_eval_tiny():
+    ctx = dukpy.Context()
+    return lambda: ctx.evaljs('1 + 1')
+
+
+@bench('eval_with_vars')
+def bench_eval_with_vars():
+    ctx = dukpy.Context()
+    return lambda: ctx.evaljs('dukpy.a + dukpy.b', a=1, b=2)
+
+
+# marshalling, Python to JavaScript
+
+@bench('to_js_numbers', SIZES)
+def bench_to_js_numbers(size):
+    ctx = dukpy.Context()
+    values = list(range(size))
+    code = 'var s = 0; for (var i = 0; i < dukpy.v.length; i++) { s += dukpy.v[i]; } s'
+    return lambda: ctx.evaljs(code, v=values)
+
+
+@bench('to_js_strings', SIZES)
+def bench_to_js_strings(size):
+    ctx = dukpy.Context()
+    values = ['value %d' % i for i in range(size)]
+    code = 'var s = 0; for (var i = 0; i < dukpy.v.length; i++) { s += dukpy.v[i].length; } s'
+    return lambda: ctx.evaljs(code, v=values)
+
+
+@bench('to_js_objects', SIZES)
+def bench_to_js_objects(size):
+    ctx = dukpy.Context()
+    values = [{'id': i, 'name': 'item %d' % i} for i in range(size)]
+    code = 'var s = 0; for (var i = 0; i < dukpy.v.length; i++) { s += dukpy.v[i].id; } s'
+    return lambda: ctx.evaljs(code, v=values)
+
+
+# marshalling, JavaScript to Python
+
+@bench('to_py_number')
+def bench_to_py_number():
+    ctx = dukpy.Context()
+    return lambda: ctx.evaljs('12345.5')
+
+
+@bench('to_py_string', (10, 1000, 100000))
+def bench_to_py_string(size):
+    ctx = dukpy.Context()
+    ctx.evaljs('var s = new Array(dukpy.n + 1).join("x")', n=size)
+    return lambda: ctx.evaljs('s')
+
+
+@bench('to_py_array', SIZES)
+def bench_to_py_array(size):
+    ctx = dukpy.Context()
+    ctx.evaljs('var a = []; for (var i = 0; i < dukpy.n; i++) { a.push(i); }', n=size)
+
+    def run():
+        a = ctx.evaljs('a')
+        return [a[i] for i in range(len(a))]
+    return run
+
+
+@bench('to_py_array_iter', SIZES)
+def bench_to_py_array_iter(size):
+    ctx = dukpy.Context()
+    ctx.evaljs('var a = []; for (var i = 0; i < dukpy.n; i++) { a.push(i); }', n=size)
+    return lambda: list(ctx.evaljs('a'))
+
+
+@bench('to_py_object', SIZES)
+def bench_to_py_object(size):
+    ctx = dukpy.Context()
+    ctx.evaljs('var o = {}; for (var i = 0; i < dukpy.n; i++) { o["k" + i] = i; }', n=size)
+    keys = ['k%d' % i for i in range(size)]
+
+    def run():
+        o = ctx.evaljs('o')
+        return dict((k, o[k]) for k in keys)
+    return run
+
+
+@bench('get_many', SIZES)
+def bench_get_many(size):
+    ctx = dukpy.Context()
+    ctx.evaljs('var o = {}; for (var i = 0; i < dukpy.n; i++) { o["k" + i] = i; }', n=size)
+    keys = ['k%d' % i for i in range(size)]
+
+    def run():
+        return ctx.evaljs('o').js_get_many(keys, as_dict=True)
+    return run
+
+
+# calls across the boundary
+
+@bench('call_python_from_js', SIZES)
+def bench_call_python_from_js(size):
+    ctx = dukpy.Context()
+    ctx.define_global('inc', lambda n: n + 1)
+    code = 'var n = 0; for (var i = 0; i < dukpy.n; i++) { n = inc(n); } n'
+    return lambda: ctx.evaljs(code, n=size)
+
+
+@bench('call_js_from_python')
+def bench_call_js_from_python():
+    ctx = dukpy.Context()
+    inc = ctx.evaljs('(function(n) { return n + 1; })')
+    return lambda: inc(1)
+
+
+@bench('proxy_get', SIZES)
+def bench_proxy_get(size):
+    ctx = dukpy.Context()
+    config = {'name': 'dukpy'}
+    code = 'var n = 0; for (var i = 0; i < dukpy.n; i++) { n += dukpy.c.name.length; } n'
+    return lambda: ctx.evaljs(code, c=config, n=size)
+
+
+@bench('proxy_set', SIZES)
+def bench_proxy_set(size):
+    ctx = dukpy.Context()
+    target = {}
+    code = 'for (var i = 0; i < dukpy.n; i++) { dukpy.t.value = i; }'
+    return lambda: ctx.evaljs(code, t=target, n=size)
+
+
+@bench('proxy_has_enumerate', (10, 1000))
+def bench_proxy_has_enumerate(size):
+    ctx = dukpy.Context()
+    target = dict(('k%d' % i, i) for i in range(size))
+    code = 'var n = 0; for (var k in dukpy.t) { if (k in dukpy.t) { n++; } } n'
+    return lambda: ctx.evaljs(code, t=target)
+
+
+# bundled compilers
+
+BABEL_SOURCE = '''
+class Point {
+    constructor(x, y) { this.x = x; this.y = y; }
+    get length() { return Math.sqrt(this.x * this.x + this.y * this.y); }
+    add({x, y}) { return new Point(this.x + x, this.y + y); }
+}
+const sum = (...points) => points.reduce((a, b) => a.add(b), new Point(0, 0));
+export default sum;
+'''
+
+COFFEE_SOURCE = '''
+class Point
+  constructor: (@x, @y) ->
+  length: -> Math.sqrt @x * @x + @y * @y
+  add: ({x, y}) -> new Point @x + x, @y + y
+
+sum = (points...) -> points.reduce ((a, b) -> a.add b), new Point 0, 0
+'''
+
+TYPESCRIPT_SOURCE = '''
+interface HasLength { length(): number; }
+class Point implements HasLength {
+    constructor(public x: number, public y: number) {}
+    length(): number { return Math.sqrt(this.x * this.x + this.y * this.y); }
+    add(other: Point): Point { return new Point(this.x + other.x, this.y + other.y); }
+}
+function sum(...points: Point[]): Point {
+    return points.reduce((a, b) => a.add(b), new Point(0, 0));
+}
+'''
+
+
+@bench('compile_babel')
+def bench_compile_babel():
+    return lambda: dukpy.babel_compile(BABEL_SOURCE)
+
+
+@bench('compile_coffee')
+def bench_compile_coffee():
+    return lambda: dukpy.coffee_compile(COFFEE_SOURCE)
+
+
+@bench('compile_typescript')
+def bench_compile_typescript():
+    return lambda: dukpy.typescript_compile(TYPESCRIPT_SOURCE)
+
+
+@bench('compile_babel_pooled')
+def bench_compile_babel_pooled():
+    from dukpy.pool import CompilerPool
+    pool = CompilerPool('babel')
+    return lambda: pool.compile(BABEL_SOURCE)
+
+
+@bench('compile_typescript_warm')
+def bench_compile_typescript_warm():
+    # an edit to one of 20 files in a long lived session
+    tsc = dukpy.TypeScriptCompiler()
+    for n in range(20):
+        tsc.compile(TYPESCRIPT_SOURCE, 'file{0}.ts'.format(n))
+    edits = itertools.count()
+    return lambda: tsc.compile(TYPESCRIPT_SOURCE + '// {0}\n'.format(next(edits)), 'file0.ts')
+
+
+# module loading
+
+TEST_JS_DIR = os.path.join(os.path.dirname(HERE), 'tests', 'testjs')
+
+
+@bench('require_fresh_context')
+def bench_require_fresh_context():
+    def run():
+        ctx = dukpy.RequirableContext([TEST_JS_DIR])
+        return ctx.evaljs("require('testjs').call()")
+    return run
+
+
+@bench('require_cached')
+def bench_require_cached():
+    ctx = dukpy.RequirableContext([TEST_JS_DIR])
+    return lambda: ctx.evaljs("require('testjs').call()")
+
+
+@bench('require_python_module')
+def bench_require_python_module():
+    def run():
+        ctx = dukpy.RequirableContext([], enable_python=True)
+        return ctx.evaljs("require('python/os').getcwd()")
+    return run
+
+
+@bench('require_large_module')
+def bench_require_large_module():
+    # the bundled CoffeeScript compiler makes for a 500KB module
+    modules = tempfile.mkdtemp()
+    atexit.register(shutil.rmtree, modules)
+    shutil.copy(os.path.join(os.path.dirname(HERE), 'dukpy', 'coffeescript.js'),
+                os.path.join(modules, 'coffeescript.js'))
+
+    def run():
+        ctx = dukpy.RequirableContext([modules])
+        return ctx.evaljs("typeof require('coffeescript')")
+    return run
+
+
+@bench('require_preloaded_graph')
+def bench_require_preloaded_graph():
+    # a cold start with a recorded graph: the three bundled compilers are
+    # compiled by worker threads before anything is required
+    modules = tempfile.mkdtemp()
+    atexit.register(shutil.rmtree, modules)
+    for name in ('coffeescript.js', 'typescriptServices.js', 'babel-4.6.6.min.js'):
+        shutil.copy(os.path.join(os.path.dirname(HERE), 'dukpy', name), modules)
+    source = "[require('coffeescript'), require('typescriptServices'), require('babel-4.6.6.min')].length"
+    ctx = dukpy.RequirableContext([modules], module_cache=dukpy.ModuleCache())
+    ctx.evaljs(source)
+    graph = ctx.module_graph()
+
+    def run():
+        ctx = dukpy.RequirableContext([modules], module_cache=dukpy.ModuleCache(),
+                                      preload=graph, preload_threads=4)
+        return ctx.evaljs(source)
+    return run
+
+
+def measure(func, min_time, repeat):
+    """Returns how many loops were run per repeat and the per call time
+    of each repeat."""
+    def run(loops):
+        start = timer()
+        for _ in range(loops):
+            func()
+        return timer() - start
+
+    func()  # warm up
+    loops = 1
+    elapsed = run(loops)
+    while elapsed < min_time:
+        # aim a bit over min_time so we don't overshoot by a factor of ten
+        if elapsed > 0:
+            loops = max(loops + 1, int(loops * min_time * 1.2 / elapsed))
+        else:
+            loops *= 10
+        elapsed = run(loops)
+
+    times = [elapsed / loops]
+    for _ in range(repeat - 1):
+        times.append(run(loops) / loops)
+    return loops, times
+
+
+def median(values):
+    values = sorted(values)
+    middle = len(values) // 2
+    if len(values) % 2:
+        return values[middle]
+    return (values[middle - 1] + values[middle]) / 2.0
+
+
+def format_time(seconds):
+    for unit, scale in (('s', 1), ('ms', 1e3), ('us', 1e6)):
+        if seconds * scale >= 1:
+            return '{0:.3g} {1}'.format(seconds * scale, unit)
+    return '{0:.3g} ns'.format(seconds * 1e9)
+
+
+def git_revision():
+    try:
+        out = subprocess.check_output(['git', 'rev-parse', 'HEAD'],
+                                      cwd=os.path.dirname(HERE),
+                                      stderr=open(os.devnull, 'w'))
+        return out.decode('ascii').strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def run_benchmarks(args):
+    results = {}
+    for name, setup in BENCHMARKS:
+        if args.filter and not any(f in name for f in args.filter):
+            continue
+        loops, times = measure(setup(), args.min_time, args.repeat)
+        results[name] = {
+            'loops': loops,
+            'times': times,
+            'median': median(times),
+            'min': min(times),
+        }
+        print('{0:40} {1:>12}  (min {2}, {3} loops)'.format(
+            name, format_time(results[name]['median']),
+            format_time(results[name]['min']), loops))
+        sys.stdout.flush()
+
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump({
+                'meta': {
+                    'revision': git_revision(),
+                    'python': platform.python_version(),
+                    'implementation': platform.python_implementation(),
+                    'platform': platform.platform(),
+                    'date': time.strftime('%Y-%m-%dT%H:%M:%S'),
+                },
+                'benchmarks': results,
+            }, f, indent=2, sort_keys=True)
+
+
+def compare(args):
+    with open(args.compare[0]) as f:
+        base = json.load(f)
+    with open(args.compare[1]) as f:
+        changed = json.load(f)
+
+    print('{0:40} {1:>12} {2:>12} {3:>8}'.format('benchmark', 'base', 'changed', 'ratio'))
+    regressions = 0
+    for name in sorted(set(base['benchmarks']) & set(changed['benchmarks'])):
+        before = base['benchmarks'][name]['median']
+        after = changed['benchmarks'][name]['median']
+        ratio = after / before if before else float('inf')
+        mark = ''
+        if ratio > 1 + args.threshold:
+            mark = '  slower'
+            regressions += 1
+        elif ratio < 1 - args.threshold:
+            mark = '  faster'
+        print('{0:40} {1:>12} {2:>12} {3:>7.2f}x{4}'.format(
+            name, format_time(before), format_time(after), ratio, mark))
+
+    if args.fail_on_regression and regressions:
+        return 1
+    return 0
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('filter', nargs='*',
+                        help='only run benchmarks whose name contains one of these')
+    parser.add_argument('--json', help='write results to this file')
+    parser.add_argument('--min-time', type=float, default=0.2,
+                        help='minimum seconds per repeat (default: %(default)s)')
+    parser.add_argument('--repeat', type=int, default=5,
+                        help='repeats per benchmark (default: %(default)s)')
+    parser.add_argument('--list', action='store_true', help='list benchmarks and exit')
+    parser.add_argument('--compare', nargs=2, metavar=('BASE', 'CHANGED'),
+                        help='compare two result files instead of running')
+    parser.add_argument('--threshold', type=float, default=0.05,
+                        help='relative change reported by --compare (default: %(default)s)')
+    parser.add_argument('--fail-on-regression', action='store_true',
+                        help='with --compare, exit 1 if anything got slower')
+    args = parser.parse_args(argv)
+
+    if args.list:
+        for name, _ in BENCHMARKS:
+            print(name)
+        return 0
+    if args.compare:
+        return compare(args)
+    run_benchmarks(args)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
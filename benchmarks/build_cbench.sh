@@ -0,0 +1,25 @@
+#!/bin/sh
+# Builds the C microbenchmarks in benchmarks/cbench.c against an embedded
+# Python, using the same Duktape options as setup.py.
+#
+#   benchmarks/build_cbench.sh && ./cbench [name-filter...]
+#
+# PYTHON_CONFIG picks the python-config to use, CC the compiler.
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+ROOT=$(dirname "$HERE")
+CC=${CC:-cc}
+PYTHON_CONFIG=${PYTHON_CONFIG:-python3-config}
+
+# --embed is needed from Python 3.8 on to get -lpython
+LDFLAGS=$($PYTHON_CONFIG --ldflags --embed 2>/dev/null || $PYTHON_CONFIG --ldflags)
+
+$CC -std=c99 -O2 -fomit-frame-pointer -fstrict-aliasing \
+    -DDUK_OPT_DEEP_C_STACK=1 \
+    -DDUK_OPT_INTERRUPT_COUNTER=1 \
+    '-DDUK_OPT_EXEC_TIMEOUT_CHECK(udata)=dukpy_exec_timeout_check(udata)' \
+    '-DDUK_OPT_DECLARE=extern int dukpy_exec_timeout_check(void *udata);' \
+    -I"$ROOT/duktape" $($PYTHON_CONFIG --includes) \
+    "$ROOT/duktape/duktape.c" "$HERE/cbench.c" \
+    $LDFLAGS -o "${OUT:-cbench}"
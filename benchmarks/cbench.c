@@ -0,0 +1,319 @@
+/*
+ * C-level microbenchmarks for the conversion core of pyduktape.c.
+ *
+ * pyduktape.c is included directly so its static helpers can be timed in
+ * isolation, without the interpreter loop around them. Build it with
+ * benchmarks/build_cbench.sh and run ./cbench [name-filter...].
+ *
+ * For every benchmark we report wall clock ns/op, TSC cycles/op where the
+ * CPU has one, and allocations/op made by Duktape (through the heap's
+ * allocator hooks) and by Python (through a counting PyMem allocator).
+ */
+#include "../pyduktape.c"
+
+#include <stdio.h>
+
+#if PY_MAJOR_VERSION < 3
+#error "cbench needs Python 3's PyMem_SetAllocator"
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CBENCH_CYCLES() __rdtsc()
+#else
+#define CBENCH_CYCLES() 0
+#endif
+
+#define CBENCH_MIN_TIME 0.2
+
+static long cbenchPyAllocs;
+static PyMemAllocatorEx cbenchObjAlloc;
+static PyMemAllocatorEx cbenchMemAlloc;
+
+static void* cbench_malloc(void *ctx, size_t size) {
+    PyMemAllocatorEx* orig = (PyMemAllocatorEx*)ctx;
+    cbenchPyAllocs++;
+    return orig->malloc(orig->ctx, size);
+}
+
+static void* cbench_calloc(void *ctx, size_t nelem, size_t elsize) {
+    PyMemAllocatorEx* orig = (PyMemAllocatorEx*)ctx;
+    cbenchPyAllocs++;
+    return orig->calloc(orig->ctx, nelem, elsize);
+}
+
+static void* cbench_realloc(void *ctx, void *ptr, size_t size) {
+    PyMemAllocatorEx* orig = (PyMemAllocatorEx*)ctx;
+    if (!ptr) {
+        cbenchPyAllocs++;
+    }
+    return orig->realloc(orig->ctx, ptr, size);
+}
+
+static void cbench_free(void *ctx, void *ptr) {
+    PyMemAllocatorEx* orig = (PyMemAllocatorEx*)ctx;
+    orig->free(orig->ctx, ptr);
+}
+
+static void cbench_count_python_allocs(void) {
+    PyMemAllocatorEx counting;
+    counting.malloc = cbench_malloc;
+    counting.calloc = cbench_calloc;
+    counting.realloc = cbench_realloc;
+    counting.free = cbench_free;
+
+    PyMem_GetAllocator(PYMEM_DOMAIN_OBJ, &cbenchObjAlloc);
+    counting.ctx = &cbenchObjAlloc;
+    PyMem_SetAllocator(PYMEM_DOMAIN_OBJ, &counting);
+
+    PyMem_GetAllocator(PYMEM_DOMAIN_MEM, &cbenchMemAlloc);
+    counting.ctx = &cbenchMemAlloc;
+    PyMem_SetAllocator(PYMEM_DOMAIN_MEM, &counting);
+}
+
+/*
+ * Shared fixtures. The Duktape value stack is empty between benchmarks
+ * except for whatever a benchmark's setup leaves at index 0.
+ */
+static duk_context *cbenchCtx;
+static PyObject *cbenchSeen;
+static PyObject *cbenchTarget;
+
+typedef void (*cbench_setup_fn)(duk_context *ctx);
+typedef void (*cbench_op_fn)(duk_context *ctx);
+
+struct CBench {
+    const char* name;
+    cbench_setup_fn setup;
+    cbench_op_fn op;
+};
+
+/* dukpy_pyobj_from_stack */
+
+static void setup_push_int(duk_context *ctx) { duk_push_int(ctx, 42); }
+static void setup_push_float(duk_context *ctx) { duk_push_number(ctx, 1.5); }
+static void setup_push_short_string(duk_context *ctx) { duk_push_string(ctx, "hello, world"); }
+static void setup_push_object(duk_context *ctx) { duk_push_object(ctx); }
+
+static void setup_push_long_string(duk_context *ctx) {
+    char buf[1025];
+    memset(buf, 'x', 1024);
+    buf[1024] = '\0';
+    duk_push_string(ctx, buf);
+}
+
+static void op_from_stack(duk_context *ctx) {
+    PyObject* obj = dukpy_pyobj_from_stack(ctx, -1, cbenchSeen, 0, 0);
+    Py_XDECREF(obj);
+}
+
+static void op_from_stack_object(duk_context *ctx) {
+    // objects are remembered in seen, so start afresh like the callers do
+    PyDict_Clear(cbenchSeen);
+    op_from_stack(ctx);
+}
+
+/* dukpy_wrap_a_python_object_somehow_and_return_it */
+
+static void setup_py_int(duk_context *ctx) {
+    Py_XDECREF(cbenchTarget);
+    cbenchTarget = PyLong_FromLong(42);
+}
+
+static void setup_py_string(duk_context *ctx) {
+    Py_XDECREF(cbenchTarget);
+    cbenchTarget = PyUnicode_FromString("hello, world");
+}
+
+static void setup_py_dict(duk_context *ctx) {
+    Py_XDECREF(cbenchTarget);
+    cbenchTarget = Py_BuildValue("{s:i,s:s}", "id", 1, "name", "dukpy");
+}
+
+static void setup_py_callable(duk_context *ctx) {
+    Py_XDECREF(cbenchTarget);
+    PyObject* builtins = PyImport_ImportModule("builtins");
+    cbenchTarget = PyObject_GetAttrString(builtins, "len");
+    Py_DECREF(builtins);
+}
+
+static void op_wrap(duk_context *ctx) {
+    // the reference is handed over to JavaScript
+    Py_INCREF(cbenchTarget);
+    dukpy_wrap_a_python_object_somehow_and_return_it(ctx, cbenchTarget);
+    duk_pop(ctx);
+}
+
+/* dukpy_generate_function, i.e. JSObject handles */
+
+static void op_handle(duk_context *ctx) {
+    struct DukPyFunction* dpf = dukpy_generate_function(ctx);
+    PyObject* capsule = PyCapsule_New((void*)dpf, DUKPY_FUNCTION_CAPSULE_NAME, dukpy_function_destructor);
+    Py_DECREF(capsule);
+}
+
+/* Proxy traps, called directly on [target key ...] */
+
+static void setup_trap_target(duk_context *ctx) {
+    setup_py_dict(ctx);
+    duk_push_object(ctx);
+    duk_push_pointer(ctx, cbenchTarget);
+    duk_put_prop_string(ctx, -2, DUKPY_INTERNAL_PROPERTY "_ptr");
+}
+
+static void setup_trap_list_target(duk_context *ctx) {
+    Py_XDECREF(cbenchTarget);
+    cbenchTarget = Py_BuildValue("[iii]", 1, 2, 3);
+    duk_push_object(ctx);
+    duk_push_pointer(ctx, cbenchTarget);
+    duk_put_prop_string(ctx, -2, DUKPY_INTERNAL_PROPERTY "_ptr");
+}
+
+static void op_trap_get(duk_context *ctx) {
+    duk_dup(ctx, 0);
+    duk_push_string(ctx, "id");
+    duk_push_undefined(ctx);
+    dukpy_objwrap_get(ctx);
+    duk_set_top(ctx, 1);
+}
+
+static void op_trap_get_index(duk_context *ctx) {
+    duk_dup(ctx, 0);
+    duk_push_int(ctx, 1);
+    duk_push_undefined(ctx);
+    dukpy_objwrap_get(ctx);
+    duk_set_top(ctx, 1);
+}
+
+static void op_trap_set(duk_context *ctx) {
+    duk_dup(ctx, 0);
+    duk_push_string(ctx, "id");
+    duk_push_int(ctx, 2);
+    duk_push_undefined(ctx);
+    dukpy_objwrap_set(ctx);
+    duk_set_top(ctx, 1);
+}
+
+static void op_trap_has(duk_context *ctx) {
+    duk_dup(ctx, 0);
+    duk_push_string(ctx, "name");
+    dukpy_objwrap_has(ctx);
+    duk_set_top(ctx, 1);
+}
+
+static void op_trap_enumerate(duk_context *ctx) {
+    duk_dup(ctx, 0);
+    dukpy_objwrap_enumerate(ctx);
+    duk_set_top(ctx, 1);
+}
+
+static const struct CBench cbenchmarks[] = {
+    {"from_stack_int", setup_push_int, op_from_stack},
+    {"from_stack_float", setup_push_float, op_from_stack},
+    {"from_stack_string_12", setup_push_short_string, op_from_stack},
+    {"from_stack_string_1k", setup_push_long_string, op_from_stack},
+    {"from_stack_object", setup_push_object, op_from_stack_object},
+    {"wrap_int", setup_py_int, op_wrap},
+    {"wrap_string_12", setup_py_string, op_wrap},
+    {"wrap_dict", setup_py_dict, op_wrap},
+    {"wrap_callable", setup_py_callable, op_wrap},
+    {"handle_create_release", NULL, op_handle},
+    {"trap_get", setup_trap_target, op_trap_get},
+    {"trap_get_index", setup_trap_list_target, op_trap_get_index},
+    {"trap_set", setup_trap_target, op_trap_set},
+    {"trap_has", setup_trap_target, op_trap_has},
+    {"trap_enumerate", setup_trap_target, op_trap_enumerate},
+    {NULL, NULL, NULL}
+};
+
+static double cbench_loop(duk_context *ctx, cbench_op_fn op, long iters) {
+    double start = dukpy_now();
+    for (long i = 0; i < iters; i++) {
+        op(ctx);
+    }
+    return dukpy_now() - start;
+}
+
+static void cbench_run(duk_context *ctx, const struct CBench* b) {
+    duk_set_top(ctx, 0);
+    if (b->setup) {
+        b->setup(ctx);
+    }
+
+    // warm up and calibrate
+    long iters = 100;
+    while (cbench_loop(ctx, b->op, iters) < CBENCH_MIN_TIME / 10) {
+        iters *= 2;
+    }
+    iters *= 10;
+
+    struct DukPyHeap* heap = dukpy_get_heap(ctx);
+    long dukAllocs = heap->allocCount + heap->reallocCount;
+    long pyAllocs = cbenchPyAllocs;
+    unsigned long long cycles = CBENCH_CYCLES();
+    double elapsed = cbench_loop(ctx, b->op, iters);
+    cycles = CBENCH_CYCLES() - cycles;
+    dukAllocs = heap->allocCount + heap->reallocCount - dukAllocs;
+    pyAllocs = cbenchPyAllocs - pyAllocs;
+
+    printf("%-24s %10.1f ns/op %10.0f cycles/op %8.2f duk allocs/op %8.2f py allocs/op\n",
+        b->name, elapsed * 1e9 / iters, (double)cycles / iters,
+        (double)dukAllocs / iters, (double)pyAllocs / iters);
+    fflush(stdout);
+
+    duk_set_top(ctx, 0);
+}
+
+static int cbench_selected(const char* name, int argc, char** argv) {
+    if (argc < 2) {
+        return 1;
+    }
+    for (int i = 1; i < argc; i++) {
+        if (strstr(name, argv[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    cbench_count_python_allocs();
+    Py_Initialize();
+
+    // a stand-in for dukpy.evaljs.JSObject
+    PyObject* globals = PyDict_New();
+    PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins());
+    PyObject* res = PyRun_String(
+        "class JSObject(object):\n"
+        "    def __init__(self, ptr):\n"
+        "        self._ptr = ptr\n",
+        Py_file_input, globals, globals);
+    if (!res) {
+        PyErr_Print();
+        return 1;
+    }
+    Py_DECREF(res);
+
+    PyObject* args = Py_BuildValue("(O)", PyDict_GetItemString(globals, "JSObject"));
+    PyObject* pyctx = DukPy_create_context(NULL, args);
+    Py_DECREF(args);
+    if (!pyctx) {
+        PyErr_Print();
+        return 1;
+    }
+    cbenchCtx = dukpy_ensure_valid_ctx(pyctx);
+    cbenchSeen = PyDict_New();
+
+    for (const struct CBench* b = cbenchmarks; b->name; b++) {
+        if (cbench_selected(b->name, argc, argv)) {
+            cbench_run(cbenchCtx, b);
+        }
+    }
+
+    Py_XDECREF(cbenchTarget);
+    Py_DECREF(cbenchSeen);
+    Py_DECREF(pyctx);
+    Py_DECREF(globals);
+    Py_Finalize();
+    return 0;
+}
@@ -1,5 +1,5 @@
-from .evaljs import evaljs, Context, RequirableContext
-from ._dukpy import JSRuntimeError
-from .coffee import coffee_compile
-from .babel import babel_compile
-from .tsc import typescript_compile
+from .evaljs import evaljs, Context, RequirableContext, ResolutionCache, ModuleCache, ModuleGraph
+from ._dukpy import JSRuntimeError, JSInterruptedError, JSTimeoutError
+from .coffee import coffee_compile, CoffeeCompiler
+from .babel import babel_compile, BabelCompiler
+from .tsc import typescript_compile, TypeScriptCompiler
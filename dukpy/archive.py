@@ -0,0 +1,238 @@
+"""Packs a tree of JavaScript modules into a single archive that
+RequirableContext can require from without touching the filesystem::
+
+    python -m dukpy.archive node_modules modules.dka --bytecode
+
+The archive starts with ``MAGIC``, the length of the index as a 32 bit
+little endian integer and the index itself, as JSON. Everything after
+that is blobs the index points at: the source of every ``.js`` and
+``.json`` file and, with ``--bytecode``, the module function it compiles
+to, along with its sha1 since Duktape loads bytecode without checking it.
+The archive is memory mapped when opened, so only the index is read up
+front.
+"""
+from __future__ import print_function
+
+import argparse
+import hashlib
+import json
+import mmap
+import os
+import struct
+import sys
+
+from . import _dukpy
+from .evaljs import Context, JS_MODULE_WRAPPER, JSON_MODULE_WRAPPER, module_wrapper, _MISSING
+
+MAGIC = b'DUKPYAR1'
+MODULE_EXTENSIONS = ('.js', '.json')
+
+
+def wrapper_digest():
+    """Identifies the module wrappers bytecode in an archive was built with"""
+    return hashlib.sha1(repr((JS_MODULE_WRAPPER, JSON_MODULE_WRAPPER)).encode('utf-8')).hexdigest()
+
+
+def pack(directory, output, bytecode=False, root=None):
+    """Writes every module in ``directory`` to the archive ``output``.
+
+    Modules are found in the archive under ``root``, which defaults to
+    ``/`` followed by the name of ``directory``, so packing a
+    ``node_modules`` directory gives ``/node_modules``."""
+    directory = os.path.abspath(directory)
+    if root is None:
+        root = '/' + os.path.basename(directory)
+
+    ctx = Context(allocator='arena') if bytecode else None
+    files = {}
+    packages = {}
+    blobs = []
+    offset = 0
+
+    for dirpath, dirnames, filenames in os.walk(directory):
+        dirnames.sort()
+        reldir = os.path.relpath(dirpath, directory).replace(os.sep, '/')
+        vdir = root if reldir == '.' else root + '/' + reldir
+        for filename in sorted(filenames):
+            if not filename.endswith(MODULE_EXTENSIONS):
+                continue
+            vpath = vdir + '/' + filename
+            with open(os.path.join(dirpath, filename), 'rb') as f:
+                source = f.read()
+
+            if filename == 'package.json':
+                try:
+                    main = json.loads(source.decode('utf-8')).get('main')
+                except (ValueError, AttributeError):
+                    main = None
+                if main:
+                    packages[vpath] = main
+
+            entry = [offset, len(source), 0, 0, None]
+            blobs.append(source)
+            offset += len(source)
+            if ctx is not None:
+                prefix, suffix = module_wrapper(vpath)
+                try:
+                    _, compiled = _dukpy.ctx_compile_source(ctx._ctx, source, vpath, prefix, suffix)
+                except _dukpy.JSRuntimeError:
+                    # left for require() to report, like any other module
+                    compiled = b''
+                entry[2:] = [offset, len(compiled), hashlib.sha1(compiled).hexdigest()]
+                blobs.append(compiled)
+                offset += len(compiled)
+            files[vpath] = entry
+
+    index = json.dumps({
+        'root': root,
+        'duk_version': _dukpy.DUK_VERSION if bytecode else None,
+        'wrapper': wrapper_digest(),
+        'files': files,
+        'packages': packages,
+    }, sort_keys=True).encode('utf-8')
+
+    tmp = output + '.tmp'
+    with open(tmp, 'wb') as f:
+        f.write(MAGIC)
+        f.write(struct.pack('<I', len(index)))
+        f.write(index)
+        for blob in blobs:
+            f.write(blob)
+    os.rename(tmp, output)
+    return len(files)
+
+
+class ModuleArchive(object):
+    """A packed module tree, opened read only.
+
+    It stands in for both the ResolutionCache and the ModuleCache of a
+    RequirableContextFinder: lookups only consult the index, and modules
+    are loaded from their bytecode when the archive has some for this
+    Duktape build, or compiled from their source once and remembered
+    otherwise."""
+
+    def __init__(self, path):
+        self.path = path
+        with open(path, 'rb') as f:
+            self._map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+
+        if self._map[:len(MAGIC)] != MAGIC:
+            raise ValueError('{0} is not a module archive'.format(path))
+        header = len(MAGIC) + 4
+        index_length, = struct.unpack('<I', self._map[len(MAGIC):header])
+        index = json.loads(self._map[header:header + index_length].decode('utf-8'))
+        self._data = header + index_length
+
+        self.root = index['root']
+        self._files = index['files']
+        self._packages = index['packages']
+        self._use_bytecode = (index['duk_version'] == _dukpy.DUK_VERSION and
+                              index['wrapper'] == wrapper_digest())
+        self._resolved = {}
+        self._compiled = {}
+        self._checked = {}
+        self.hits = 0
+        self.misses = 0
+        self.corrupt = 0
+
+    def _blob(self, offset, length):
+        start = self._data + offset
+        return self._map[start:start + length]
+
+    def _bytecode(self, path, prefix, suffix):
+        """The archive's bytecode for ``path`` if it can be used and is what
+        was packed, None otherwise"""
+        entry = self._files[path]
+        if not self._use_bytecode or len(entry) < 5 or not entry[3] or (prefix, suffix) != module_wrapper(path):
+            return None
+        bytecode = self._blob(entry[2], entry[3])
+        ok = self._checked.get(path)
+        if ok is None:
+            ok = self._checked[path] = hashlib.sha1(bytecode).hexdigest() == entry[4]
+            if not ok:
+                self.corrupt += 1
+        return bytecode if ok else None
+
+    def isfile(self, path):
+        return path in self._files
+
+    def package_main(self, path):
+        return self._packages.get(path)
+
+    def get(self, key):
+        return self._resolved.get(key, _MISSING)
+
+    def put(self, key, path):
+        self._resolved[key] = path
+
+    def load(self, pyctx, path, prefix, suffix):
+        src_offset, src_length = self._files[path][:2]
+
+        bytecode = self._bytecode(path, prefix, suffix)
+        if bytecode is None:
+            bytecode = self._compiled.get((path, prefix, suffix))
+        if bytecode is not None:
+            self.hits += 1
+            return _dukpy.ctx_load_function(pyctx, bytecode)
+
+        self.misses += 1
+        func, bytecode = _dukpy.ctx_compile_source(pyctx, self._blob(src_offset, src_length),
+                                                   path, prefix, suffix)
+        self._compiled[(path, prefix, suffix)] = bytecode
+        return func
+
+    def prepare(self, path, prefix, suffix):
+        """Compiles a module the archive has no usable bytecode for ahead
+        of time, see ModuleCache.prepare."""
+        src_offset, src_length = self._files[path][:2]
+        if self._bytecode(path, prefix, suffix) is not None:
+            return
+        if (path, prefix, suffix) in self._compiled:
+            return
+        bytecode = _dukpy.compile_bytecode(self._blob(src_offset, src_length), path, prefix, suffix)
+        if bytecode is not None:
+            self._compiled[(path, prefix, suffix)] = bytecode
+
+    def stats(self):
+        return {
+            'hits': self.hits,
+            'misses': self.misses,
+            'files': len(self._files),
+            'packages': len(self._packages),
+            'bytecode': self._use_bytecode,
+            'corrupt': self.corrupt,
+        }
+
+
+_ARCHIVES = {}
+
+
+def open_archive(archive):
+    """Returns ``archive`` if it's already a ModuleArchive, otherwise the
+    ModuleArchive at that path, which is opened once per process."""
+    if isinstance(archive, ModuleArchive):
+        return archive
+    path = os.path.abspath(archive)
+    try:
+        return _ARCHIVES[path]
+    except KeyError:
+        ret = _ARCHIVES[path] = ModuleArchive(path)
+        return ret
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description='Packs a module tree into an archive for RequirableContext.')
+    parser.add_argument('directory', help='directory to pack, usually node_modules')
+    parser.add_argument('output', help='archive to write')
+    parser.add_argument('--bytecode', action='store_true',
+                        help='also store compiled modules, only used by this Duktape version')
+    parser.add_argument('--root', help='where modules are found in the archive (default: /<directory name>)')
+    args = parser.parse_args(argv)
+
+    count = pack(args.directory, args.output, args.bytecode, args.root)
+    print('packed {0} files into {1}'.format(count, args.output))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
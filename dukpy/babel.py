@@ -1,14 +1,51 @@
 import os
-from .evaljs import evaljs
+from .evaljs import Context
 
 BABEL_COMPILER = os.path.join(os.path.dirname(__file__), 'babel-4.6.6.min.js')
 
+BABEL_TRANSFORM = '''
+(function (overrides) {
+    return function (code, filename) {
+        var options = {};
+        for (var key in overrides) {
+            options[key] = overrides[key];
+        }
+        if (filename) {
+            options.filename = filename;
+        }
+        var result = babel.transform(code, options);
+        return [result.code, result.map ? JSON.stringify(result.map) : null];
+    };
+})(dukpy.options)
+'''
+
 
 def babel_compile(source):
     """Compiles the given ``source`` from ES6 to ES5 usin Babeljs"""
-    with open(BABEL_COMPILER, 'r') as babel_js:
-        return evaljs(
-            (babel_js.read(),
-             'babel.transform(dukpy.es6code).code'),
-            es6code=source
-        )
+    ctx = Context()
+    ctx.evaljs_file(BABEL_COMPILER)
+    return ctx.evaljs('babel.transform(dukpy.es6code).code', es6code=source)
+
+
+class BabelCompiler(object):
+    """Keeps Babel loaded to compile any number of sources from ES6 to
+    ES5 with the same ``options``, which are passed to ``babel.transform``.
+
+    A compiler isn't thread safe, use one per thread."""
+
+    name = 'babel'
+    compiler_file = BABEL_COMPILER
+
+    def __init__(self, options=None):
+        self.ctx = Context()
+        self.ctx.evaljs_file(BABEL_COMPILER)
+        self._transform = self.ctx.evaljs(BABEL_TRANSFORM, options=options or {})
+
+    def compile(self, source, filename=None):
+        """Compiles ``source`` and returns the code"""
+        return self.transform(source, filename)[0]
+
+    def transform(self, source, filename=None):
+        """Compiles ``source`` and returns ``(code, source_map)``, the
+        source map is None unless the ``sourceMap`` option was given."""
+        return tuple(self._transform(source, filename))
@@ -1,14 +1,54 @@
 import os
-from .evaljs import evaljs
+from .evaljs import Context
 
 COFFEE_COMPILER = os.path.join(os.path.dirname(__file__), 'coffeescript.js')
 
+COFFEE_TRANSFORM = '''
+(function (overrides) {
+    return function (code, filename) {
+        var options = {};
+        for (var key in overrides) {
+            options[key] = overrides[key];
+        }
+        if (filename) {
+            options.filename = filename;
+        }
+        var result = CoffeeScript.compile(code, options);
+        if (typeof result === 'string') {
+            return [result, null];
+        }
+        return [result.js, result.v3SourceMap];
+    };
+})(dukpy.options)
+'''
+
 
 def coffee_compile(source):
     """Compiles the given ``source`` from CoffeeScript to JavaScript"""
-    with open(COFFEE_COMPILER, 'r') as coffeescript_js:
-        return evaljs(
-            (coffeescript_js.read(),
-             'CoffeeScript.compile(dukpy.coffeecode)'),
-            coffeecode=source
-        )
+    ctx = Context()
+    ctx.evaljs_file(COFFEE_COMPILER)
+    return ctx.evaljs('CoffeeScript.compile(dukpy.coffeecode)', coffeecode=source)
+
+
+class CoffeeCompiler(object):
+    """Keeps CoffeeScript loaded to compile any number of sources with the
+    same ``options``, which are passed to ``CoffeeScript.compile``.
+
+    A compiler isn't thread safe, use one per thread."""
+
+    name = 'coffee'
+    compiler_file = COFFEE_COMPILER
+
+    def __init__(self, options=None):
+        self.ctx = Context()
+        self.ctx.evaljs_file(COFFEE_COMPILER)
+        self._transform = self.ctx.evaljs(COFFEE_TRANSFORM, options=options or {})
+
+    def compile(self, source, filename=None):
+        """Compiles ``source`` and returns the code"""
+        return self.transform(source, filename)[0]
+
+    def transform(self, source, filename=None):
+        """Compiles ``source`` and returns ``(code, source_map)``, the
+        source map is None unless the ``sourceMap`` option was given."""
+        return tuple(self._transform(source, filename))
@@ -3,6 +3,10 @@ from . import _dukpy
 import os.path
 import json
 import importlib
+import contextlib
+import hashlib
+import itertools
+import tempfile
 
 try:  # pragma: no cover
     unicode
@@ -16,42 +20,462 @@ def evaljs(code, **kwargs):
     return Context().evaljs(code, **kwargs)
 
 
+GC_POLICIES = {
+    'never': 0,
+    'every': 1,
+    'threshold': 2,
+}
+
+ALLOCATORS = {
+    'pymem': 0,
+    'pool': 1,
+    'arena': 2,
+}
+
+
 class Context(object):
-    def __init__(self):
-        self._ctx = _dukpy.new_context(JSObject)
+    def __init__(self, gc_policy='never', gc_interval=1, gc_threshold=8 * 1024 * 1024,
+                 allocator='pymem', max_heap_bytes=None):
+        """Creates a new JavaScript heap.
+
+        ``allocator`` picks where the heap gets its memory from: ``'pymem'``
+        goes through Python's allocator, ``'pool'`` uses size-class slabs
+        that are released in bulk with the context, and ``'arena'`` bump
+        allocates from regions that are only released with the context,
+        which suits short lived contexts like one-off compiles.
+
+        ``max_heap_bytes`` caps how much memory the heap may hold; going
+        over it makes the evaluation raise a ``MemoryError``."""
+        try:
+            allocator = ALLOCATORS[allocator]
+        except KeyError:
+            raise ValueError('unknown allocator {0!r}'.format(allocator))
+        self._ctx = _dukpy.new_context(JSObject, allocator)
+        self.set_gc_policy(gc_policy, gc_interval, gc_threshold)
+        if max_heap_bytes is not None:
+            self.set_memory_limit(max_heap_bytes)
+
+    def set_gc_policy(self, policy, interval=1, threshold=8 * 1024 * 1024):
+        """Chooses when a full garbage collection is forced before evaluating code.
+
+        ``'never'`` leaves it to Duktape's own refcounting and voluntary
+        collection, ``'every'`` collects every ``interval`` evaluations and
+        ``'threshold'`` collects once ``threshold`` bytes have been allocated
+        since the last collection."""
+        try:
+            policy = GC_POLICIES[policy]
+        except KeyError:
+            raise ValueError('unknown garbage collection policy {0!r}'.format(policy))
+        _dukpy.ctx_set_gc_policy(self._ctx, policy, interval, threshold)
+
+    def gc(self, compact=False):
+        """Runs a full garbage collection now.
+
+        With ``compact`` objects pending finalization are swept as well and
+        the global object is compacted."""
+        _dukpy.ctx_gc(self._ctx, compact)
+
+    def gc_stats(self):
+        """Returns how many collections were forced and how long they took"""
+        return _dukpy.ctx_gc_stats(self._ctx)
+
+    def set_memory_limit(self, max_heap_bytes):
+        """Caps the live size of the heap at ``max_heap_bytes``, or lifts
+        the cap when it's ``None``. Allocations over the cap fail cleanly and
+        the evaluation raises ``MemoryError``, leaving the context usable."""
+        _dukpy.ctx_set_memory_limit(self._ctx, max_heap_bytes or 0)
+
+    def memory_stats(self):
+        """Returns live and peak heap bytes, allocation counters and how
+        many entries the global stash holds"""
+        return _dukpy.ctx_memory_stats(self._ctx)
+
+    def stats(self):
+        """Returns counters for traffic across the Python/JavaScript boundary:
+        calls into Python, Proxy traps by kind, ``JSObject`` handles created
+        and released, values converted in each direction by type, string
+        bytes transferred and the time spent evaluating, in Python callbacks
+        and converting results.
+
+        Raises ``RuntimeError`` unless dukpy was built with ``DUKPY_STATS=1``."""
+        return _dukpy.ctx_stats(self._ctx)
+
+    def allocator_stats(self):
+        """Returns how much memory the heap's allocator holds and uses.
+
+        ``reserved_bytes`` is what the allocator got from the system and
+        ``used_bytes`` is what's handed out to Duktape, block headers and
+        arena padding included; their ratio measures fragmentation."""
+        stats = _dukpy.ctx_allocator_stats(self._ctx)
+        stats['allocator'] = dict((v, k) for k, v in ALLOCATORS.items())[stats['allocator']]
+        return stats
+
+    @contextlib.contextmanager
+    def budget(self, timeout=None, cpu_timeout=None):
+        """Limits any JavaScript run inside the ``with`` block to ``timeout``
+        seconds of wall time and ``cpu_timeout`` seconds of CPU time.
+
+        Running over raises ``JSTimeoutError``. Budgets nest, the tightest
+        one wins."""
+        previous = _dukpy.ctx_set_deadlines(self._ctx, timeout or 0, cpu_timeout or 0)
+        try:
+            yield
+        finally:
+            _dukpy.ctx_restore_deadlines(self._ctx, previous)
+
+    @contextlib.contextmanager
+    def profile(self, every=1, lines=False):
+        """Samples the JavaScript callstack while the ``with`` block runs,
+        yielding a :class:`Profile` that's filled in when the block exits.
+
+        Duktape checks in every 256K bytecode instructions; a sample is
+        taken every ``every`` of those checks. With ``lines`` frames also
+        record the line they're executing, which splits them up further."""
+        profile = Profile()
+        _dukpy.ctx_profile_start(self._ctx, every, lines)
+        try:
+            yield profile
+        finally:
+            profile.samples = _dukpy.ctx_profile_stop(self._ctx)
+
+    def interrupt(self):
+        """Aborts the JavaScript this context is running, raising
+        ``JSInterruptedError`` from it. Safe to call from any thread; if
+        nothing is running the next evaluation is aborted instead."""
+        _dukpy.ctx_interrupt(self._ctx)
 
     def define_global(self, name, obj):
         _dukpy.ctx_add_global_object(self._ctx, name, obj)
 
     def evaljs(self, code, **kwargs):
-        """Evaluates the given ``code`` as JavaScript and returns the result"""
-        jscode = code
+        """Evaluates the given ``code`` as JavaScript and returns the result
+
+        ``code`` may also be a sequence of chunks, which are joined with
+        ``';\n'`` into a single compilation unit. That takes one copy of
+        the whole input; :meth:`evaljs_units` compiles every chunk in
+        place instead, and is the one that takes ``(filename, code)``
+        chunks."""
+        if isinstance(code, string_types):
+            return _dukpy.ctx_eval_string(self._ctx, code, kwargs)
+
+        # sequences of chunks are joined together natively
+        return _dukpy.ctx_eval_chunks(self._ctx, code, kwargs, False)
+
+    def evaljs_units(self, units, **kwargs):
+        """Evaluates each of ``units`` as a separate JavaScript compilation
+        unit, in order, and returns the result of the last one.
+
+        Every unit is either some code (``str``, ``bytes`` or anything
+        exposing a buffer, like an ``mmap``) or a ``(filename, code)`` tuple,
+        in which case ``filename`` shows up in stack traces."""
+        return _dukpy.ctx_eval_chunks(self._ctx, units, kwargs, True)
+
+    def evaljs_file(self, path, **kwargs):
+        """Evaluates the JavaScript file at ``path`` and returns the result.
+
+        The file is memory mapped and compiled in place, and its path is
+        used as the filename in stack traces."""
+        return _dukpy.ctx_eval_file(self._ctx, path, kwargs)
+
+
+class Profile(object):
+    """Callstack samples collected by :meth:`Context.profile`.
+
+    ``samples`` maps ``"root;caller;leaf"`` stacks to how many times they
+    were seen."""
+    def __init__(self):
+        self.samples = {}
+
+    @property
+    def total(self):
+        return sum(self.samples.values())
+
+    def collapsed(self):
+        """Returns the samples in the collapsed stack format read by
+        flamegraph.pl and speedscope"""
+        return ''.join('{0} {1}\n'.format(stack, count)
+                       for stack, count in sorted(self.samples.items()))
+
+    def write(self, path):
+        with open(path, 'w') as f:
+            f.write(self.collapsed())
+
+
+class ResolutionCache(object):
+    """Remembers what RequirableContextFinder learnt from the filesystem:
+    which candidate paths are files, the ``main`` of every package.json it
+    read and which file every ``(requesting dir, id)`` resolved to,
+    including ids that couldn't be found.
+
+    By default what was found is trusted until :meth:`clear` is called, so
+    files removed afterwards go unnoticed, but lookups that found nothing
+    are done again, so modules added later turn up. ``validate_missing=False``
+    caches those too. With ``validate`` only the resolutions are kept: each
+    one is checked to still be a file, and package.json files are parsed
+    again whenever their mtime changes."""
+
+    def __init__(self, validate=False, validate_missing=True):
+        self.validate = validate
+        self.validate_missing = validate_missing
+        self.clear()
+
+    def clear(self):
+        self._files = {}
+        self._packages = {}
+        self._resolved = {}
+        self.hits = 0
+        self.misses = 0
+
+    def isfile(self, path):
+        if self.validate:
+            return os.path.isfile(path)
+        try:
+            return self._files[path]
+        except KeyError:
+            ret = os.path.isfile(path)
+            if ret or not self.validate_missing:
+                self._files[path] = ret
+            return ret
+
+    def package_main(self, path):
+        """The ``main`` entry of the package.json at ``path``, if there is one"""
+        if self.validate:
+            try:
+                mtime = os.stat(path).st_mtime
+            except OSError:
+                return None
+        else:
+            mtime = None
+
+        cached = self._packages.get(path)
+        if cached is not None and cached[0] == mtime:
+            return cached[1]
+
+        main = None
+        if not self.validate and self.validate_missing and not os.path.isfile(path):
+            return None
+        if self.validate or os.path.isfile(path):
+            try:
+                with open(path) as f:
+                    main = json.load(f).get('main')
+            except IOError:
+                pass
+        self._packages[path] = (mtime, main)
+        return main
+
+    def get(self, key):
+        """The path ``key`` resolved to, None if it couldn't be found or
+        ``_MISSING`` if it has to be resolved again."""
+        path = self._resolved.get(key, _MISSING)
+        if path is None and (self.validate or self.validate_missing):
+            path = _MISSING
+        elif self.validate and path is not _MISSING and not os.path.isfile(path):
+            path = _MISSING
+        if path is _MISSING:
+            self.misses += 1
+        else:
+            self.hits += 1
+        return path
+
+    def put(self, key, path):
+        self._resolved[key] = path
+
+    def stats(self):
+        return {
+            'hits': self.hits,
+            'misses': self.misses,
+            'resolved': len(self._resolved),
+            'files': len(self._files),
+            'packages': len(self._packages),
+        }
+
+
+_MISSING = object()
+
+
+class ModuleCache(object):
+    """Compiled module functions, kept as Duktape bytecode so other
+    contexts can load them without lexing and compiling the source again.
+
+    Entries are keyed by the file's path, mtime and size, the Duktape
+    version and the wrapper put around the source. With ``directory`` the
+    bytecode is also written there and read back by later processes. The
+    bytecode is loaded as-is, so the directory must only be writable by
+    trusted users."""
+
+    MAGIC = b'DUKPYBC1'
+
+    def __init__(self, directory=None):
+        self.directory = directory
+        self.clear()
+
+    def clear(self):
+        """Forgets everything kept in memory, the directory is left alone"""
+        self._bytecode = {}
+        self.hits = 0
+        self.misses = 0
+        self.prepared = 0
+
+    def _key(self, path, prefix, suffix):
+        st = os.stat(path)
+        return (path, st.st_mtime, st.st_size, _dukpy.DUK_VERSION, prefix, suffix)
+
+    def load(self, pyctx, path, prefix, suffix):
+        """Returns the function ``prefix + <source of path> + suffix``
+        compiles to, in the context ``pyctx``."""
+        key = self._key(path, prefix, suffix)
+
+        bytecode = self._bytecode.get(key)
+        if bytecode is None and self.directory:
+            bytecode = self._read(key)
+        if bytecode is not None:
+            self.hits += 1
+            return _dukpy.ctx_load_function(pyctx, bytecode)
+
+        self.misses += 1
+        func, bytecode = _dukpy.ctx_compile_file(pyctx, path, prefix, suffix)
+        self._bytecode[key] = bytecode
+        if self.directory:
+            self._write(key, bytecode)
+        return func
+
+    def prepare(self, path, prefix, suffix):
+        """Compiles the module at ``path`` ahead of time, unless it's
+        already cached, so that a later ``load`` only loads bytecode.
+
+        This needs no context and releases the GIL while compiling, so it
+        can be called from several threads at once."""
+        key = self._key(path, prefix, suffix)
+        if key in self._bytecode or (self.directory and self._read(key) is not None):
+            return
+        with open(path, 'rb') as f:
+            source = f.read()
+        bytecode = _dukpy.compile_bytecode(source, path, prefix, suffix)
+        if bytecode is None:
+            return  # left for load() to report
+        self._bytecode[key] = bytecode
+        self.prepared += 1
+        if self.directory:
+            self._write(key, bytecode)
+
+    def stats(self):
+        return {
+            'hits': self.hits,
+            'misses': self.misses,
+            'prepared': self.prepared,
+            'entries': len(self._bytecode),
+            'bytes': sum(len(b) for b in self._bytecode.values()),
+        }
+
+    def _cache_file(self, key):
+        digest = hashlib.sha1(repr(key).encode('utf-8')).hexdigest()
+        return os.path.join(self.directory, digest + '.dkc')
+
+    def _read(self, key):
+        try:
+            with open(self._cache_file(key), 'rb') as f:
+                data = f.read()
+        except IOError:
+            return None
+
+        # a torn or foreign file must never get to duk_load_function
+        header = len(self.MAGIC) + 20
+        if data[:len(self.MAGIC)] != self.MAGIC:
+            return None
+        bytecode = data[header:]
+        if hashlib.sha1(bytecode).digest() != data[len(self.MAGIC):header]:
+            return None
+        self._bytecode[key] = bytecode
+        return bytecode
+
+    def _write(self, key, bytecode):
+        try:
+            if not os.path.isdir(self.directory):
+                os.makedirs(self.directory)
+            fd, tmp = tempfile.mkstemp(dir=self.directory, suffix='.tmp')
+            with os.fdopen(fd, 'wb') as f:
+                f.write(self.MAGIC + hashlib.sha1(bytecode).digest() + bytecode)
+            os.rename(tmp, self._cache_file(key))
+        except (IOError, OSError):
+            pass
+
+
+# shared by every RequirableContext that doesn't bring its own
+RESOLUTION_CACHE = ResolutionCache()
+MODULE_CACHE = ModuleCache()
+
+# what module sources get wrapped in to become module functions, which
+# the native require() calls with (require, exports, module)
+JSON_MODULE_WRAPPER = ("function (require, exports, module) {\nmodule.exports = (", "\n);\n}")
+JS_MODULE_WRAPPER = ("function (require, exports, module) {\n", "\n}")
+
+
+def module_wrapper(located_path):
+    """The ``(prefix, suffix)`` that turn the source of the module at
+    ``located_path`` into its module function."""
+    if located_path.endswith('.json'):
+        return JSON_MODULE_WRAPPER
+    return JS_MODULE_WRAPPER
+
+
+class ModuleGraph(object):
+    """The modules a RequirableContext loaded, as ``(base, id, path)``
+    tuples in the order require() first asked for them: the directory of
+    the requiring module (None from global code), the id it asked for and
+    the path it resolved to (None for Python modules).
 
-        if not isinstance(code, string_types):
-            jscode = ';\n'.join(code)
+    Graphs can be saved as JSON and handed to another context's
+    ``preload`` to resolve and compile everything up front."""
 
-        return _dukpy.ctx_eval_string(self._ctx, jscode, kwargs)
+    def __init__(self, modules=()):
+        self.modules = [tuple(m) for m in modules]
+
+    def __iter__(self):
+        return iter(self.modules)
+
+    def __len__(self):
+        return len(self.modules)
+
+    def save(self, path):
+        with open(path, 'w') as f:
+            json.dump({'modules': self.modules}, f)
+
+    @classmethod
+    def load(cls, path):
+        with open(path) as f:
+            return cls(json.load(f)['modules'])
 
 
 class RequirableContextFinder(object):
-    def __init__(self, search_paths, enable_python=False):
-        self.search_paths = search_paths
+    def __init__(self, search_paths, enable_python=False, resolution_cache=None, module_cache=None,
+                 env_whitelist=None):
+        self.search_paths = tuple(search_paths)
         self.enable_python = enable_python
+        self.env_whitelist = None if env_whitelist is None else tuple(env_whitelist)
+        if resolution_cache is None:
+            resolution_cache = RESOLUTION_CACHE
+        self.cache = resolution_cache
+        if module_cache is None:
+            module_cache = MODULE_CACHE
+        self.module_cache = module_cache
+        self.loaded = []
 
     def contribute(self, req_ctx):
-        import os
-        req_ctx.evaljs("Duktape.modSearch = dukpy.modSearch;", modSearch=req_ctx.wrap(self.require))
-        req_ctx.evaljs("Duktape.resolverBase = null;")
-        req_ctx.evaljs("process = {}; process.env = dukpy.environ", environ=dict(os.environ))
+        # require() is native and keeps the module registry itself, it
+        # only calls load for modules it hasn't seen yet
+        _dukpy.ctx_install_require(req_ctx._ctx, self.load)
+        # process.env reads the environment with getenv() as variables are
+        # used, nothing is copied up front
+        _dukpy.ctx_install_process_env(req_ctx._ctx, self.env_whitelist)
 
     def load_node_modules(self, search_id, search_path, recurse_downwards):
         if recurse_downwards:
             node_modules_dirs = []
 
             search_path_pieces = search_path.split('/')
-            for n in range(len(search_path_pieces)-1, -1, -1):
-                if search_path_pieces[n] == 'node_modules':
-                    continue  # we'll end up generating this anyway
+            for n in range(len(search_path_pieces), -1, -1):
+                if n and search_path_pieces[n-1] == 'node_modules':
+                    continue  # no node_modules/node_modules
                 node_modules_dirs.append(os.path.join('/'.join(search_path_pieces[:n]), 'node_modules'))
         else:
             node_modules_dirs = [search_path]
@@ -62,121 +486,218 @@ class RequirableContextFinder(object):
                 return ret
 
     def load_as_file_or_directory(self, path):
+        path = os.path.normpath(path)
         try_files = [path, path + '.js', path + '.json']
         for try_file in try_files:
-            if os.path.exists(try_file) and os.path.isfile(try_file):
+            if self.cache.isfile(try_file):
                 return try_file
 
-        packagejson = os.path.join(path, 'package.json')
-        if os.path.exists(packagejson):
-            try:
-                with open(packagejson) as f:
-                    package = json.load(f)
-                if 'main' in package:
-                    ret = self.load_as_file_or_directory(os.path.join(path, package['main']))
-                    if ret:
-                        return ret
-            except IOError:
-                pass
+        main = self.cache.package_main(os.path.join(path, 'package.json'))
+        if main:
+            ret = self.load_as_file_or_directory(os.path.join(path, main))
+            if ret:
+                return ret
 
         nextsteps = ['index.js', 'index.json']
         for nextstep in nextsteps:
             nextstep = os.path.join(path, nextstep)
-            if os.path.exists(nextstep):
+            if self.cache.isfile(nextstep):
                 return nextstep
 
+    def locate(self, start_path, search_id):
+        """The path of the module ``search_id`` required from a module in
+        ``start_path``, or from global code when that's None.
 
-    def resolve(self, req_ctx, id_, search_paths):
-        # we need to resolve id_ left-to-right
-        search_paths = list(search_paths)
-        if id_[0] == '!' and id_[-1] == '!':
-            start_path = str(req_ctx.evaljs("Duktape.resolverBase"))
-            search_id = id_[1:-1]
-        else:
-            start_path = None
-            search_id = id_
-        found_path = None
+        Like node, the ``node_modules`` of ``start_path`` itself and of
+        every directory above it are searched, nearest first, and then
+        ``search_paths`` in order: the first one that has the module
+        wins."""
+        key = (start_path, search_id, self.search_paths)
+        found_path = self.cache.get(key)
+        if found_path is _MISSING:
+            found_path = None
 
-        if not found_path and start_path:
-            found_path = self.load_as_file_or_directory(os.path.join(start_path, search_id))
+            if not found_path and start_path:
+                found_path = self.load_as_file_or_directory(os.path.join(start_path, search_id))
 
-        if not found_path and start_path:
-            found_path = self.load_node_modules(search_id, start_path, True)
+            if not found_path and start_path:
+                found_path = self.load_node_modules(search_id, start_path, True)
 
-        if not found_path:
-            for search_path in search_paths:
-                found_path = self.load_node_modules(search_id, search_path, False)
+            if not found_path:
+                for search_path in self.search_paths:
+                    found_path = self.load_node_modules(search_id, search_path, False)
+                    if found_path:
+                        break
+
+            self.cache.put(key, found_path)
 
         if not found_path:
-            raise ImportError("unable to find " + id_)
+            raise ImportError("unable to find " + search_id)
 
-        with open(found_path, 'r') as f:
-            return f.read(), found_path
+        return found_path
 
-    def require(self, req_ctx, id_, require, exports, module):
+    def load(self, pyctx, start_path, id_):
+        """Called by require() for modules it hasn't loaded yet, returns
+        ``(path, function, exports)``: the module's path and either its
+        module function or, for Python modules, its exports."""
         # does the module ID begin with 'python/'
         if self.enable_python and id_.startswith('python/'):
-            pyid = id_[len('python/'):].replace('/', '.')
-            ret = self.require_python(pyid, require, exports, module)
-            if ret:
-                return ret
-
-        r = self.resolve(req_ctx, id_, self.search_paths)
-        if r:
-            ret, located_path = r
-            if located_path.endswith('.json'):
-                return "module.exports = (" + ret + ");"
-
-            # do a slight cheat here
-            # basically we want to make sure that the names
-            # are resolved relative to the correct path, so we override
-            # require.id to our "canonicalized" name
-            #
-            # we also need to make sure that <blah>/ requires are accepted
-            req_ctx.define_global("_dukpy_last_module", os.path.dirname(located_path))
-            ret = """
-require = (function(_require, locatedPath) {
-    return function(mToLoad) {
-        Duktape.resolverBase = locatedPath;
-        return _require('!' + mToLoad + '!');
-    };
-})(require, _dukpy_last_module);
-delete _dukpy_last_module;
-
-(function() {
-""" + ret + """
-})();
-"""
-
-            return ret
+            exports = self.require_python(id_[len('python/'):].replace('/', '.'))
+            if exports is not None:
+                self.loaded.append((start_path, id_, None))
+                return id_, None, exports
+
+        located_path = self.locate(start_path, id_)
+        prefix, suffix = module_wrapper(located_path)
+        func = self.module_cache.load(pyctx, located_path, prefix, suffix)
+        self.loaded.append((start_path, id_, located_path))
+        return located_path, func, None
+
+    def preload(self, graph, threads=0):
+        """Resolves every JavaScript module in ``graph`` and compiles the
+        ones the module cache doesn't have yet, with ``threads`` worker
+        threads when it's more than one. Modules that can't be found or
+        compiled any more are skipped; requiring them raises as usual."""
+        jobs = []
+        seen = set()
+        for base, id_, path in graph:
+            if path is None:
+                continue
+            try:
+                located_path = self.locate(base, id_)
+            except ImportError:
+                continue
+            if located_path not in seen:
+                seen.add(located_path)
+                jobs.append((located_path,) + module_wrapper(located_path))
+
+        prepare = getattr(self.module_cache, 'prepare', None)
+        if prepare is None:
+            return
+
+        def run(job):
+            try:
+                prepare(*job)
+            except (IOError, OSError):
+                pass
 
-        raise ImportError("Unable to load {}".format(id_))
+        if threads > 1 and len(jobs) > 1:
+            from multiprocessing.pool import ThreadPool
+            pool = ThreadPool(min(threads, len(jobs)))
+            try:
+                pool.map(run, jobs)
+            finally:
+                pool.close()
+                pool.join()
+        else:
+            for job in jobs:
+                run(job)
 
-    def require_python(self, pyid, require, exports, module):
+    def require_python(self, pyid):
         try:
             pymod = importlib.import_module(pyid)
         except ImportError:
             return None
 
-        all_things = getattr(pymod, '__all__', [x for x in dir(pymod) if x and x[0] != '_'])
-        for thing in all_things:
-            exports[thing] = getattr(pymod, thing)
-        return True
+        # a single proxy, so attributes are only wrapped when they're used
+        return python_module_exports(pymod)
+
+
+def python_module_exports(module):
+    """What ``require('python/...')`` returns: the names in the module's
+    ``__all__``, or its public names if it has none, looked up on the
+    module as JavaScript asks for them.
+
+    The objwrap traps fall back to attributes, so the view has no
+    attributes of its own: everything it knows lives in this closure."""
+    names = []
+
+    def exported():
+        if not names:
+            found = getattr(module, '__all__', None)
+            if found is None:
+                found = [x for x in dir(module) if x and x[0] != '_']
+            names.append(frozenset(found))
+        return names[0]
+
+    class PythonModuleExports(object):
+        __slots__ = ()
+
+        def __getattribute__(self, name):
+            if name not in exported():
+                raise AttributeError(name)
+            return getattr(module, name)
+
+        def __contains__(self, name):
+            return name in exported()
+
+        def __iter__(self):
+            return iter(sorted(exported()))
+
+        def __dir__(self):
+            return sorted(exported())
+
+    return PythonModuleExports()
 
 
 class RequirableContext(Context):
-    def __init__(self, search_paths, enable_python=False):
-        super(RequirableContext, self).__init__()
-        self.finder = RequirableContextFinder(search_paths, enable_python)
+    def __init__(self, search_paths=(), enable_python=False, resolution_cache=None, module_cache=None,
+                 archive=None, env_whitelist=None, preload=None, preload_threads=0, **kwargs):
+        """A context with a ``require`` that looks modules up in
+        ``search_paths`` like node does.
+
+        Resolutions are remembered in ``resolution_cache``, which defaults
+        to the shared ``RESOLUTION_CACHE``; pass a
+        ``ResolutionCache(validate=True)`` if files come and go while the
+        process runs. Compiled modules are kept in ``module_cache``, the
+        shared ``MODULE_CACHE`` by default.
+
+        With ``archive``, a :class:`dukpy.archive.ModuleArchive` or the
+        path of one, modules are only looked up in the archive and never
+        on disk; ``search_paths`` then name directories inside it and
+        default to its root.
+
+        ``process.env`` reads the live process environment. Assigning to
+        it only affects this context. Pass ``env_whitelist``, a list of
+        variable names, to hide everything else.
+
+        ``preload`` takes a :class:`ModuleGraph`, usually recorded by an
+        earlier context's ``module_graph()``, and resolves and compiles
+        all of its modules before the context is used, spread over
+        ``preload_threads`` threads. Nothing is evaluated until the
+        modules are required."""
+        super(RequirableContext, self).__init__(**kwargs)
+        if archive is not None:
+            from .archive import open_archive
+            archive = open_archive(archive)
+            search_paths = list(search_paths) or [archive.root]
+            resolution_cache = module_cache = archive
+        self.finder = RequirableContextFinder(search_paths, enable_python, resolution_cache, module_cache,
+                                              env_whitelist)
         self.finder.contribute(self)
+        if preload is not None:
+            self.preload(preload, preload_threads)
+
+    def module_graph(self):
+        """The :class:`ModuleGraph` of every module loaded so far"""
+        return ModuleGraph(self.finder.loaded)
 
-    def wrap(self, callable):
-        def inner(*args, **kwargs):
-            return callable(self, *args, **kwargs)
-        return inner
+    def preload(self, graph, threads=0):
+        """Resolves and compiles the modules in ``graph`` ahead of time"""
+        self.finder.preload(graph, threads)
+
+
+# how many elements JSObject iteration converts per call into Duktape
+ITER_CHUNK_SIZE = 1024
 
 
 class JSObject(object):
+    """A JavaScript object or function living in a context.
+
+    Attributes and items read and write the object's properties, so the
+    helpers below are all prefixed with ``js_`` to stay out of their way:
+    ``obj.map`` is still the ``map`` property of a JavaScript array."""
+
     def __init__(self, ptr):
         self._ptr = ptr
 
@@ -188,12 +709,99 @@ class JSObject(object):
                 raise TypeError(str(e)[len('TypeError: '):])
             raise
 
+    def js_map(self, iterable):
+        """Calls this function with each item of ``iterable`` as its only
+        argument and returns the list of results.
+
+        The function is looked up once and the loop runs natively, which is
+        much cheaper than calling it from a Python loop."""
+        return self._map(iterable, False)
+
+    def js_starmap(self, iterable):
+        """Like :meth:`js_map`, but every item of ``iterable`` is a sequence
+        of arguments."""
+        return self._map(iterable, True)
+
+    def js_imap(self, iterable, star=False, chunk_size=1024):
+        """Lazy version of :meth:`js_map` (or :meth:`js_starmap` with ``star``)
+        which calls the function ``chunk_size`` items at a time, so no more
+        than that many results are buffered."""
+        iterator = iter(iterable)
+        while True:
+            chunk = list(itertools.islice(iterator, chunk_size))
+            if not chunk:
+                return
+            for result in self._map(chunk, star):
+                yield result
+
+    def _map(self, iterable, star):
+        try:
+            return _dukpy.dpf_map(self._ptr, iterable, star)
+        except _dukpy.JSRuntimeError as e:
+            if str(e).startswith('TypeError: '):
+                raise TypeError(str(e)[len('TypeError: '):])
+            raise
+
     def __getitem__(self, key):
         return _dukpy.dpf_get_item(self._ptr, str(key))
 
     def __setitem__(self, key, value):
         return _dukpy.dpf_set_item(self._ptr, str(key), value)
 
+    def js_get_many(self, keys, as_dict=False):
+        """Reads all of ``keys`` in one go and returns their values as a
+        tuple, or as a dict when ``as_dict`` is set."""
+        keys = [str(key) for key in keys]
+        values = _dukpy.dpf_get_many(self._ptr, keys)
+        if as_dict:
+            return dict(zip(keys, values))
+        return values
+
+    def js_update(self, *args, **kwargs):
+        """Sets properties from a mapping or iterable of pairs and keyword
+        arguments in one go, like ``dict.update``."""
+        items = dict(*args, **kwargs)
+        _dukpy.dpf_update(self._ptr, [(str(k), v) for k, v in items.items()])
+
+    def __iter__(self):
+        """Iterates over the elements of arrays and over the keys of any
+        other object, like a dict."""
+        first = _dukpy.dpf_slice(self._ptr, 0, ITER_CHUNK_SIZE)
+        if first is None:
+            return iter(self.js_keys())
+        return self._iter_array(first, ITER_CHUNK_SIZE)
+
+    def _iter_array(self, chunk, chunk_size):
+        start = 0
+        while chunk:
+            for value in chunk:
+                yield value
+            start += len(chunk)
+            chunk = _dukpy.dpf_slice(self._ptr, start, chunk_size)
+
+    def js_keys(self):
+        """The object's own enumerable property names, as Object.keys
+        returns them."""
+        return _dukpy.dpf_keys(self._ptr)
+
+    def js_values(self, chunk_size=ITER_CHUNK_SIZE):
+        """Iterates over the elements of an array, or over the values of
+        :meth:`js_keys` for any other object, fetching ``chunk_size`` of them
+        at a time."""
+        first = _dukpy.dpf_slice(self._ptr, 0, chunk_size)
+        if first is not None:
+            return self._iter_array(first, chunk_size)
+        return (value for _, value in self.js_items(chunk_size))
+
+    def js_items(self, chunk_size=ITER_CHUNK_SIZE):
+        """Iterates over ``(key, value)`` pairs of the object's own
+        enumerable properties, fetching ``chunk_size`` of them at a time."""
+        keys = self.js_keys()
+        for start in range(0, len(keys), chunk_size):
+            chunk = keys[start:start + chunk_size]
+            for item in zip(chunk, _dukpy.dpf_get_many(self._ptr, chunk)):
+                yield item
+
     def __getattr__(self, key):
         if key == '_ptr':
             return super(JSObject, self).__getattr__(key)
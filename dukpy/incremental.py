@@ -0,0 +1,274 @@
+"""Incremental builds with the bundled compilers.
+
+An :class:`IncrementalCompiler` keeps what it compiled in an on-disk
+cache keyed by the hash of the source, the compiler and its options, and
+only boots a compiler when something isn't in there yet::
+
+    python -m dukpy.incremental babel src/ build/ --watch
+"""
+from __future__ import print_function
+
+import argparse
+import collections
+import hashlib
+import json
+import os
+import sys
+import tempfile
+import time
+
+from ._dukpy import JSRuntimeError
+from .babel import BabelCompiler
+from .coffee import CoffeeCompiler
+from .tsc import TypeScriptCompiler
+
+COMPILERS = {
+    'babel': (BabelCompiler, ('.js', '.es6')),
+    'coffee': (CoffeeCompiler, ('.coffee',)),
+    'typescript': (TypeScriptCompiler, ('.ts',)),
+}
+
+_COMPILER_VERSIONS = {}
+
+
+def compiler_version(compiler_class):
+    """A digest of the JavaScript the compiler is made of, computed once
+    per process."""
+    path = compiler_class.compiler_file
+    try:
+        return _COMPILER_VERSIONS[path]
+    except KeyError:
+        with open(path, 'rb') as f:
+            version = _COMPILER_VERSIONS[path] = hashlib.sha1(f.read()).hexdigest()
+        return version
+
+
+class OutputCache(object):
+    """Compiled code and source maps, one JSON file per entry under
+    ``directory``. Entries are written atomically, so several builds can
+    share a directory."""
+
+    def __init__(self, directory):
+        self.directory = directory
+
+    def _path(self, key):
+        return os.path.join(self.directory, key[:2], key + '.json')
+
+    def get(self, key):
+        try:
+            with open(self._path(key)) as f:
+                entry = json.load(f)
+        except (IOError, OSError, ValueError):
+            return None
+        return entry['code'], entry['map']
+
+    def put(self, key, code, source_map):
+        path = self._path(key)
+        try:
+            if not os.path.isdir(os.path.dirname(path)):
+                os.makedirs(os.path.dirname(path))
+            fd, tmp = tempfile.mkstemp(dir=os.path.dirname(path), suffix='.tmp')
+            with os.fdopen(fd, 'w') as f:
+                json.dump({'code': code, 'map': source_map}, f)
+            os.rename(tmp, path)
+        except (IOError, OSError):
+            pass
+
+
+class IncrementalCompiler(object):
+    """Compiles sources with one of the bundled compilers (``'babel'``,
+    ``'coffee'`` or ``'typescript'``), reusing earlier output.
+
+    Outputs are looked up by the hash of the source, the compiler version
+    and ``options``: in memory, then in ``cache_dir`` when given. Only the
+    ``max_outputs`` most recently used ones are kept in memory. The
+    compiler itself is only loaded on the first miss and then kept warm.
+    """
+
+    def __init__(self, compiler='babel', cache_dir=None, options=None, max_outputs=1024):
+        try:
+            self.compiler_class, self.extensions = COMPILERS[compiler]
+        except KeyError:
+            raise ValueError('unknown compiler {0!r}'.format(compiler))
+        self.options = options or {}
+        self.cache = OutputCache(cache_dir) if cache_dir else None
+        self._compiler = None
+        self.max_outputs = max_outputs
+        self._outputs = collections.OrderedDict()
+        self._stamps = {}
+        self._built = {}
+        self.errors = {}
+        self._salt = json.dumps([compiler, compiler_version(self.compiler_class), self.options],
+                                sort_keys=True).encode('utf-8')
+        self.hits = 0
+        self.misses = 0
+
+    @property
+    def compiler(self):
+        if self._compiler is None:
+            self._compiler = self.compiler_class(self.options)
+        return self._compiler
+
+    def key(self, source, filename=None):
+        digest = hashlib.sha1(self._salt)
+        if self.options.get('sourceMap'):
+            # source maps name the file they were made from
+            digest.update(repr(filename).encode('utf-8'))
+        digest.update(source.encode('utf-8'))
+        return digest.hexdigest()
+
+    def transform(self, source, filename=None):
+        """Returns ``(code, source_map)`` for ``source``"""
+        key = self.key(source, filename)
+        output = self._outputs.pop(key, None)
+        if output is None and self.cache is not None:
+            output = self.cache.get(key)
+        if output is not None:
+            self.hits += 1
+            self._remember(key, output)
+            return output
+
+        self.misses += 1
+        output = self.compiler.transform(source, filename)
+        self._remember(key, output)
+        if self.cache is not None:
+            self.cache.put(key, output[0], output[1])
+        return output
+
+    def _remember(self, key, output):
+        self._outputs[key] = output
+        while len(self._outputs) > self.max_outputs:
+            self._outputs.popitem(last=False)
+
+    def compile(self, source, filename=None):
+        return self.transform(source, filename)[0]
+
+    def build(self, src_dir, out_dir, on_error=None):
+        """Compiles every source under ``src_dir`` that changed since the
+        last build into ``out_dir``, keeping the directory layout, and
+        returns the paths that were written. Source maps are written next
+        to the output as ``.map`` files.
+
+        A source that fails to compile doesn't stop the build: its error
+        is kept in ``errors`` and passed to ``on_error(path, error)``, and
+        it's compiled again by the next build. The output of sources that
+        were deleted since the last build is removed. ``out_dir`` and the
+        cache directory are skipped when they live under ``src_dir``, so
+        outputs are never taken for sources."""
+        written = []
+        seen = set()
+        skip = set([os.path.abspath(out_dir)])
+        if self.cache is not None:
+            skip.add(os.path.abspath(self.cache.directory))
+        for root, dirs, files in os.walk(src_dir):
+            dirs[:] = sorted(d for d in dirs if os.path.abspath(os.path.join(root, d)) not in skip)
+            for name in sorted(files):
+                if not name.endswith(self.extensions):
+                    continue
+                path = os.path.join(root, name)
+                seen.add(path)
+                st = os.stat(path)
+                stamp = (st.st_mtime, st.st_size)
+                if self._stamps.get(path) == stamp:
+                    continue
+
+                out_path = os.path.join(out_dir, os.path.relpath(path, src_dir))
+                out_path = os.path.splitext(out_path)[0] + '.js'
+                with open(path, 'rb') as f:
+                    source = f.read().decode('utf-8')
+                try:
+                    code, source_map = self.transform(source, path)
+                except JSRuntimeError as e:
+                    self._stamps.pop(path, None)
+                    self.errors[path] = e
+                    if on_error is not None:
+                        on_error(path, e)
+                    continue
+                self.errors.pop(path, None)
+                self._write(out_path, code)
+                if source_map:
+                    self._write(out_path + '.map', source_map)
+                self._stamps[path] = stamp
+                self._built[path] = out_path
+                written.append(out_path)
+
+        self._prune(src_dir, seen)
+        return written
+
+    def _prune(self, src_dir, seen):
+        prefix = os.path.join(src_dir, '')
+        for path in [p for p in self._built if p.startswith(prefix) and p not in seen]:
+            out_path = self._built.pop(path)
+            self._stamps.pop(path, None)
+            self.errors.pop(path, None)
+            for output in (out_path, out_path + '.map'):
+                try:
+                    os.remove(output)
+                except OSError:
+                    pass
+            remove = getattr(self._compiler, 'remove', None)
+            if remove is not None:
+                remove(path)
+        for path in [p for p in self.errors if p.startswith(prefix) and p not in seen]:
+            del self.errors[path]
+
+    def watch(self, src_dir, out_dir, interval=0.5, on_build=None, on_error=None):
+        """Builds ``src_dir`` into ``out_dir`` whenever something in it
+        changes, polling every ``interval`` seconds, until interrupted.
+        ``on_build`` is called with the paths each build wrote and
+        ``on_error`` with each source that failed, see :meth:`build`."""
+        while True:
+            written = self.build(src_dir, out_dir, on_error)
+            if written and on_build is not None:
+                on_build(written)
+            time.sleep(interval)
+
+    def stats(self):
+        return {
+            'hits': self.hits,
+            'misses': self.misses,
+            'errors': len(self.errors),
+            'compiler_loaded': self._compiler is not None,
+        }
+
+    @staticmethod
+    def _write(path, text):
+        if not os.path.isdir(os.path.dirname(path)):
+            os.makedirs(os.path.dirname(path))
+        with open(path, 'wb') as f:
+            f.write(text.encode('utf-8'))
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description='Compiles a directory with one of the bundled compilers, incrementally.')
+    parser.add_argument('compiler', choices=sorted(COMPILERS))
+    parser.add_argument('src_dir')
+    parser.add_argument('out_dir')
+    parser.add_argument('--cache-dir', help='keep compiled output here across runs')
+    parser.add_argument('--source-maps', action='store_true', help='also write source maps')
+    parser.add_argument('--watch', action='store_true', help='keep rebuilding as files change')
+    parser.add_argument('--interval', type=float, default=0.5, help='seconds between checks in watch mode')
+    args = parser.parse_args(argv)
+
+    options = {'sourceMap': True} if args.source_maps else None
+    compiler = IncrementalCompiler(args.compiler, args.cache_dir, options)
+
+    def report(written):
+        for path in written:
+            print(path)
+        sys.stdout.flush()
+
+    def report_error(path, error):
+        print('{0}: {1}'.format(path, error), file=sys.stderr)
+
+    report(compiler.build(args.src_dir, args.out_dir, report_error))
+    if args.watch:
+        try:
+            compiler.watch(args.src_dir, args.out_dir, args.interval, report, report_error)
+        except KeyboardInterrupt:
+            pass
+    return 1 if compiler.errors else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,139 @@
+"""Warm compilers shared by every thread in the process.
+
+Loading Babel or TypeScript takes far longer than compiling a typical
+file, so callers that compile now and then, like the webassets filters,
+borrow an already loaded compiler from a pool instead::
+
+    >>> dukpy.pool.get_pool('babel').compile(source)
+"""
+import json
+import sys
+import threading
+import time
+
+from .incremental import COMPILERS, compiler_version
+
+try:
+    import queue
+except ImportError:  # Python 2
+    import Queue as queue
+
+text_type = str if sys.version_info[0] >= 3 else unicode  # noqa: F821
+
+
+class CompilerPool(object):
+    """Up to ``size`` warm compilers of one kind, each used by one thread
+    at a time. Compilers are only loaded when there's no idle one and the
+    pool isn't full yet, otherwise callers wait for one to be returned.
+
+    Pooled compilers live as long as the process, so they're made to
+    forget every file once it's compiled rather than keep it around."""
+
+    def __init__(self, compiler='babel', size=1, options=None):
+        try:
+            self.compiler_class = COMPILERS[compiler][0]
+        except KeyError:
+            raise ValueError('unknown compiler {0!r}'.format(compiler))
+        self.name = compiler
+        self.size = max(1, size)
+        self.options = options or {}
+        self._idle = queue.LifoQueue()
+        self._lock = threading.Lock()
+        self._created = 0
+        self.compiles = 0
+        self.compile_time = 0.0
+        self.load_time = 0.0
+        self.waits = 0
+
+    @property
+    def version(self):
+        """Changes whenever the compiler's JavaScript does"""
+        return compiler_version(self.compiler_class)
+
+    def _acquire(self):
+        try:
+            return self._idle.get_nowait()
+        except queue.Empty:
+            pass
+
+        with self._lock:
+            create = self._created < self.size
+            if create:
+                self._created += 1
+            else:
+                self.waits += 1
+        if not create:
+            return self._idle.get()
+
+        start = time.time()
+        try:
+            compiler = self.compiler_class(self.options)
+        except Exception:
+            with self._lock:
+                self._created -= 1
+            raise
+        with self._lock:
+            self.load_time += time.time() - start
+        return compiler
+
+    def transform(self, source, filename=None):
+        """Compiles ``source`` and returns ``(code, source_map)``"""
+        compiler = self._acquire()
+        try:
+            start = time.time()
+            try:
+                code, source_map = compiler.transform(source, filename)
+            finally:
+                forget = getattr(compiler, 'remove', None)
+                if forget is not None:
+                    forget(filename)
+            elapsed = time.time() - start
+        finally:
+            self._idle.put(compiler)
+
+        with self._lock:
+            self.compiles += 1
+            self.compile_time += elapsed
+        if not isinstance(code, text_type):
+            code = code.decode('utf-8')
+        return code, source_map
+
+    def compile(self, source, filename=None):
+        return self.transform(source, filename)[0]
+
+    def stats(self):
+        with self._lock:
+            return {
+                'compiler': self.name,
+                'compilers': self._created,
+                'size': self.size,
+                'compiles': self.compiles,
+                'compile_time': self.compile_time,
+                'load_time': self.load_time,
+                'waits': self.waits,
+            }
+
+
+_POOLS = {}
+_POOLS_LOCK = threading.Lock()
+
+
+def get_pool(compiler, options=None, size=None):
+    """The process wide pool for ``compiler`` with ``options``. ``size``
+    only matters to the call that creates it, or grows an existing pool."""
+    key = (compiler, json.dumps(options or {}, sort_keys=True))
+    with _POOLS_LOCK:
+        pool = _POOLS.get(key)
+        if pool is None:
+            pool = _POOLS[key] = CompilerPool(compiler, size or 1, options)
+        elif size and size > pool.size:
+            with pool._lock:
+                pool.size = size
+        return pool
+
+
+def pool_stats():
+    """``stats()`` of every pool created so far"""
+    with _POOLS_LOCK:
+        pools = list(_POOLS.values())
+    return [pool.stats() for pool in pools]
@@ -1,15 +1,122 @@
 import os
-from .evaljs import evaljs
+from .evaljs import Context
 
 TS_COMPILER = os.path.join(os.path.dirname(__file__), 'typescriptServices.js')
 TSC_OPTIONS = '{ module: ts.ModuleKind.CommonJS, target: ts.ScriptTarget.ES5, newLine: 1 }'
 
+# A language service host over an in-memory set of files. Each file gets a
+# new version whenever its text changes, which is how the language service
+# knows which source files it can keep from the last program. Versions are
+# never reused, not even by a file that was removed and added back.
+TSC_SERVICE = '''
+(function (overrides) {
+    var options = %(options)s;
+    for (var key in overrides) {
+        options[key] = overrides[key];
+    }
+    // the same as ts.transpile: every file on its own, no lib, no imports
+    options.isolatedModules = true;
+    options.allowNonTsExtensions = true;
+    options.noLib = true;
+    options.noResolve = true;
+
+    var files = {};
+    var version = 0;
+    var host = {
+        getCompilationSettings: function () { return options; },
+        getScriptFileNames: function () { return Object.keys(files); },
+        getScriptVersion: function (name) { return files[name] ? String(files[name].version) : ''; },
+        getScriptSnapshot: function (name) {
+            return files[name] ? ts.ScriptSnapshot.fromString(files[name].text) : undefined;
+        },
+        getNewLine: function () { return ts.getNewLineCharacter(options); },
+        getCurrentDirectory: function () { return ''; },
+        getDefaultLibFileName: function () { return 'lib.d.ts'; }
+    };
+    var service = ts.createLanguageService(host, ts.createDocumentRegistry());
+
+    return {
+        emit: function (name, text) {
+            files[name] = {version: ++version, text: text};
+
+            var output = service.getEmitOutput(name).outputFiles;
+            var code = '', map = null;
+            for (var i = 0; i < output.length; i++) {
+                if (/\\.map$/.test(output[i].name)) {
+                    map = output[i].text;
+                } else {
+                    code = output[i].text;
+                }
+            }
+            return [code, map];
+        },
+        remove: function (name) {
+            delete files[name];
+        }
+    };
+})(dukpy.options)
+'''
+
 
 def typescript_compile(source):
     """Compiles the given ``source`` from TypeScript to ES5 using TypescriptServices.js"""
-    with open(TS_COMPILER, 'r') as tsservices_js:
-        return evaljs(
-            (tsservices_js.read(),
-             'ts.transpile(dukpy.tscode, {options});'.format(options=TSC_OPTIONS)),
-            tscode=source
-        )
+    ctx = Context()
+    ctx.evaljs_file(TS_COMPILER)
+    return ctx.evaljs('ts.transpile(dukpy.tscode, {options});'.format(options=TSC_OPTIONS), tscode=source)
+
+
+class TypeScriptCompiler(object):
+    """A TypeScript compiler session that keeps TypescriptServices.js loaded.
+
+    Files are handed to a language service by name, so recompiling a
+    changed file only parses that file again, and compiling a file with
+    the same source as last time returns the previous output without
+    calling into TypeScript at all. The output is the same as
+    :func:`typescript_compile` gives; ``options`` are compiler options
+    set on top of its defaults.
+
+    A session isn't thread safe, use one per thread."""
+
+    name = 'typescript'
+    compiler_file = TS_COMPILER
+
+    def __init__(self, options=None):
+        self.ctx = Context()
+        self.ctx.evaljs_file(TS_COMPILER)
+        self._service = self.ctx.evaljs(TSC_SERVICE % {'options': TSC_OPTIONS}, options=options or {})
+        self._emit = self._service['emit']
+        self._files = {}
+        self.hits = 0
+        self.misses = 0
+
+    def compile(self, source, filename=None):
+        """Compiles ``source`` as the file ``filename``"""
+        return self.transform(source, filename)[0]
+
+    def transform(self, source, filename=None):
+        """Compiles ``source`` as the file ``filename`` and returns
+        ``(code, source_map)``, the source map is None unless the
+        ``sourceMap`` option was given."""
+        filename = filename or 'module.ts'
+        cached = self._files.get(filename)
+        if cached is not None and cached[0] == source:
+            self.hits += 1
+            return cached[1]
+
+        self.misses += 1
+        output = tuple(self._emit(filename, source))
+        self._files[filename] = (source, output)
+        return output
+
+    def remove(self, filename):
+        """Forgets ``filename``, e.g. because it was deleted"""
+        filename = filename or 'module.ts'
+        if self._files.pop(filename, None) is not None:
+            self._service['remove'](filename)
+
+    def stats(self):
+        return {
+            'files': len(self._files),
+            'hits': self.hits,
+            'misses': self.misses,
+        }
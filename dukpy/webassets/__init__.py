@@ -1 +1 @@
-from .babelfilter import BabelJS
+from .babelfilter import BabelJS, TypeScript, CoffeeScript
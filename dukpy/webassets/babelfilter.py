@@ -2,22 +2,50 @@
 from __future__ import absolute_import, print_function
 from webassets.filter import Filter
 
-import dukpy
-import sys
+from dukpy.pool import get_pool
 
 
-__all__ = ('BabelJS', )
+__all__ = ('BabelJS', 'TypeScript', 'CoffeeScript')
 
 
-class BabelJS(Filter):
-    name = 'babeljs'
+class DukpyCompilerFilter(Filter):
+    """Compiles each input with a warm compiler from the process wide
+    pool, so only the first file pays for loading the compiler.
+
+    ``pool_size`` (or the ``DUKPY_POOL_SIZE`` setting) is how many
+    compilers may be loaded to serve threads building at the same time."""
+
+    compiler = None
     max_debug_level = None
+    options = {'pool_size': 'DUKPY_POOL_SIZE'}
+    pool_size = None
+
+    @property
+    def pool(self):
+        return get_pool(self.compiler, size=int(self.pool_size or 1))
+
+    def unique(self):
+        # cached output is stale as soon as the compiler changes
+        return self.compiler, self.pool.version
 
     def input(self, _in, out, **kw):
-        indata = _in.read()
-        if sys.version_info[0] < 3:
-            indata = indata.encode('utf-8')
-        src = dukpy.babel_compile(indata)
-        if sys.version_info[0] < 3:
-            src = src.decode('utf-8')
-        out.write(src)
+        out.write(self.pool.compile(_in.read(), kw.get('source_path')))
+
+    @classmethod
+    def stats(cls):
+        return get_pool(cls.compiler).stats()
+
+
+class BabelJS(DukpyCompilerFilter):
+    name = 'babeljs'
+    compiler = 'babel'
+
+
+class TypeScript(DukpyCompilerFilter):
+    name = 'typescript'
+    compiler = 'typescript'
+
+
+class CoffeeScript(DukpyCompilerFilter):
+    name = 'coffeescript'
+    compiler = 'coffee'
@@ -1,8 +1,14 @@
+// Python.h goes first so it gets to pick the POSIX feature macros
+#include <Python.h>
+#include "structmember.h"
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
-#include <Python.h>
-#include "structmember.h"
+#include <math.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 #include "duktape.h"
 
 #define UNUSED(x) (void)(x)
@@ -33,6 +39,8 @@ extern "C" {
 #endif
 
 static PyObject *DukPyError;
+static PyObject *DukPyInterruptedError;
+static PyObject *DukPyTimeoutError;
 static const char* DUKPY_CONTEXT_CAPSULE_NAME = "dukpy.dukcontext";
 static const char* DUKPY_FUNCTION_CAPSULE_NAME = "dukpy.dukfunction";
 static const char* DUKPY_PTR_CAPSULE_NAME = "dukpy.miscpointer";
@@ -46,6 +54,171 @@ struct DukPyFunction {
     const char* name;
 };
 
+#define DUKPY_GC_NEVER 0
+#define DUKPY_GC_EVERY 1
+#define DUKPY_GC_THRESHOLD 2
+
+#define DUKPY_ALLOC_PYMEM 0
+#define DUKPY_ALLOC_POOL 1
+#define DUKPY_ALLOC_ARENA 2
+
+#define DUKPY_POOL_CLASSES 12
+#define DUKPY_SLAB_SIZE (64 * 1024)
+#define DUKPY_ARENA_CHUNK_SIZE (256 * 1024)
+
+#define DUKPY_BLOCK_PYMEM -1
+#define DUKPY_BLOCK_LARGE -2
+#define DUKPY_BLOCK_ARENA -3
+
+// every block handed to Duktape sits right behind one of these
+union DukPyBlockHeader {
+    struct {
+        duk_size_t size; // as requested by Duktape
+        int kind; // pool size class, or one of DUKPY_BLOCK_*
+        int releaseOffset; // see dukpy_push_release_slots, 0 for most blocks
+    } info;
+    double align[2];
+};
+
+// free pool blocks keep the free list in their payload
+#define DUKPY_NEXT_FREE(hdr) (*(union DukPyBlockHeader**)((hdr) + 1))
+// arena blocks are padded to keep the next header aligned
+#define DUKPY_ARENA_ROUND(n) (((n) + sizeof(union DukPyBlockHeader) - 1) & ~(sizeof(union DukPyBlockHeader) - 1))
+
+// slabs for the pool allocator and chunks for the arena allocator
+struct DukPyMemChunk {
+    struct DukPyMemChunk* next;
+    size_t size;
+    size_t used;
+};
+
+// bridge counters, only maintained when built with DUKPY_STATS
+struct DukPyStats {
+    long pyCalls;
+    long trapGet;
+    long trapSet;
+    long trapHas;
+    long trapDelete;
+    long trapEnumerate;
+    long handlesCreated;
+    long handlesReleased;
+
+    // dukpy_pyobj_from_stack
+    long toPyNone;
+    long toPyBool;
+    long toPyInt;
+    long toPyFloat;
+    long toPyString;
+    long toPyJSObject;
+    long toPyBytes;
+    long toPyOther;
+
+    // dukpy_wrap_a_python_object_somehow_and_return_it
+    long toJSNull;
+    long toJSBool;
+    long toJSNumber;
+    long toJSString;
+    long toJSCallable;
+    long toJSUnwrapped;
+    long toJSProxy;
+
+    size_t stringBytesToPy;
+    size_t stringBytesToJS;
+
+    double evalTime;       // in outermost protected calls, callbacks included
+    double callbackTime;   // in Python callables called from JavaScript
+    double conversionTime; // turning results into Python objects
+};
+
+// per-heap state, handed to Duktape as the heap udata
+struct DukPyHeap {
+    // allocator, see dukpy_block_alloc
+    int allocator;
+    union DukPyBlockHeader* poolFree[DUKPY_POOL_CLASSES];
+    struct DukPyMemChunk* chunks;
+    long chunkCount;
+    size_t reservedBytes;
+    size_t usedBytes;
+
+    // accounting and limits, see dukpy_malloc
+    size_t liveBytes;
+    size_t peakBytes;
+    size_t maxHeapBytes; // 0 for no limit
+    long allocCount;
+    long reallocCount;
+    long freeCount;
+    long failedAllocs;
+    int limitExceeded;
+    int protectedDepth;
+    // the thread running JavaScript while protectedDepth > 0, see dukpy_check_owner
+    unsigned long owner;
+    // JSObject handles released by other threads meanwhile, deleted once it's done
+    char** orphanHandles;
+    size_t orphanCount;
+    size_t orphanCapacity;
+
+    // garbage collection policy, see dukpy_maybe_gc
+    int gcPolicy;
+    long gcInterval;
+    size_t gcThreshold;
+
+    long evalsSinceGC;
+    size_t bytesSinceGC;
+    long gcCount;
+    double gcTime;
+
+    // references dropped by dead wrappers, see dukpy_queue_release
+    PyObject** releaseQueue;
+    size_t releaseCount;
+    size_t releaseCapacity;
+    long releasedRefs;
+    long releaseBatches;
+
+    // execution budgets, see dukpy_exec_timeout_check
+    double deadline;    // CLOCK_MONOTONIC, 0 for none
+    double cpuDeadline; // CLOCK_THREAD_CPUTIME_ID, 0 for none
+    volatile int interruptRequested;
+    int abortReason;
+    PyObject* abortType;
+    PyObject* abortValue;
+    PyObject* abortTraceback;
+
+    // module loader, see dukpy_module_require
+    PyObject* pyctx; // borrowed, it owns us
+    PyObject* moduleLoader;
+
+    // sampling profiler, see dukpy_profile_sample
+    duk_context* ctx;
+    PyObject* profileSamples; // collapsed stack -> count, NULL when off
+    long profileEvery;
+    long profileCountdown;
+    int profileLines;
+
+#ifdef DUKPY_STATS
+    struct DukPyStats stats;
+    double evalStart;
+#endif
+};
+
+#ifdef DUKPY_STATS
+#define DUKPY_STAT_ADD(ctx, field, n) (dukpy_get_heap(ctx)->stats.field += (n))
+#define DUKPY_STAT_TIMER_START(var) double var = dukpy_now()
+#define DUKPY_STAT_TIMER_STOP(ctx, field, var) DUKPY_STAT_ADD(ctx, field, dukpy_now() - (var))
+#else
+#define DUKPY_STAT_ADD(ctx, field, n) ((void)0)
+#define DUKPY_STAT_TIMER_START(var) ((void)0)
+#define DUKPY_STAT_TIMER_STOP(ctx, field, var) ((void)0)
+#endif
+#define DUKPY_STAT_INC(ctx, field) DUKPY_STAT_ADD(ctx, field, 1)
+
+#define DUKPY_PROFILE_MAX_DEPTH 64
+
+#define DUKPY_ABORT_NONE 0
+#define DUKPY_ABORT_INTERRUPTED 1
+#define DUKPY_ABORT_TIMEOUT 2
+#define DUKPY_ABORT_CPU_TIMEOUT 3
+#define DUKPY_ABORT_PYERR 4
+
 static int dukpy_wrap_a_python_object_somehow_and_return_it(duk_context *ctx, PyObject* obj);
 
 static const char* dukpy_encode_cesu8(const char* inp) {
@@ -243,20 +416,422 @@ static struct DukPyFunction* dukpy_generate_function(duk_context* ctx) {
     return dpf;
 }
 
+static double dukpy_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double dukpy_cpu_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct DukPyHeap* dukpy_get_heap(duk_context *ctx) {
+    duk_memory_functions funcs;
+    duk_get_memory_functions(ctx, &funcs);
+    return (struct DukPyHeap*)funcs.udata;
+}
+
+// Pool sizes are picked around what Duktape allocates most: strings and
+// small objects at the bottom, property tables and buffers further up.
+static const size_t dukpy_pool_classes[DUKPY_POOL_CLASSES] = {
+    16, 32, 48, 64, 80, 96, 128, 160, 192, 256, 384, 512
+};
+
+static int dukpy_pool_class_for(size_t size) {
+    for (int i = 0; i < DUKPY_POOL_CLASSES; i++) {
+        if (size <= dukpy_pool_classes[i]) {
+            return i;
+        }
+    }
+    return DUKPY_BLOCK_LARGE;
+}
+
+static union DukPyBlockHeader* dukpy_pool_alloc(struct DukPyHeap* heap, int sizeClass) {
+    size_t blockSize = sizeof(union DukPyBlockHeader) + dukpy_pool_classes[sizeClass];
+
+    if (!heap->poolFree[sizeClass]) {
+        // carve a fresh slab up into blocks of this class
+        struct DukPyMemChunk* slab = malloc(DUKPY_SLAB_SIZE);
+        if (!slab) {
+            return NULL;
+        }
+        slab->next = heap->chunks;
+        slab->size = DUKPY_SLAB_SIZE;
+        slab->used = DUKPY_SLAB_SIZE;
+        heap->chunks = slab;
+        heap->reservedBytes += DUKPY_SLAB_SIZE;
+        heap->chunkCount++;
+
+        char* walk = (char*)(slab + 1);
+        char* end = (char*)slab + DUKPY_SLAB_SIZE;
+        for (; walk + blockSize <= end; walk += blockSize) {
+            union DukPyBlockHeader* block = (union DukPyBlockHeader*)walk;
+            DUKPY_NEXT_FREE(block) = heap->poolFree[sizeClass];
+            heap->poolFree[sizeClass] = block;
+        }
+    }
+
+    union DukPyBlockHeader* hdr = heap->poolFree[sizeClass];
+    heap->poolFree[sizeClass] = DUKPY_NEXT_FREE(hdr);
+    hdr->info.kind = sizeClass;
+    heap->usedBytes += blockSize;
+    return hdr;
+}
+
+static union DukPyBlockHeader* dukpy_arena_alloc(struct DukPyHeap* heap, size_t size) {
+    size_t blockSize = DUKPY_ARENA_ROUND(sizeof(union DukPyBlockHeader) + size);
+
+    struct DukPyMemChunk* chunk = heap->chunks;
+    if (!chunk || chunk->size - chunk->used < blockSize) {
+        chunk = malloc(DUKPY_ARENA_CHUNK_SIZE);
+        if (!chunk) {
+            return NULL;
+        }
+        chunk->next = heap->chunks;
+        chunk->size = DUKPY_ARENA_CHUNK_SIZE;
+        chunk->used = sizeof(struct DukPyMemChunk);
+        heap->chunks = chunk;
+        heap->reservedBytes += DUKPY_ARENA_CHUNK_SIZE;
+        heap->chunkCount++;
+    }
+
+    union DukPyBlockHeader* hdr = (union DukPyBlockHeader*)((char*)chunk + chunk->used);
+    chunk->used += blockSize;
+    hdr->info.kind = DUKPY_BLOCK_ARENA;
+    heap->usedBytes += blockSize;
+    return hdr;
+}
+
+static size_t dukpy_block_size(union DukPyBlockHeader* hdr) {
+    if (hdr->info.kind >= 0) {
+        return sizeof(union DukPyBlockHeader) + dukpy_pool_classes[hdr->info.kind];
+    }
+    return sizeof(union DukPyBlockHeader) + hdr->info.size;
+}
+
+static union DukPyBlockHeader* dukpy_block_alloc(struct DukPyHeap* heap, size_t size) {
+    union DukPyBlockHeader* hdr = NULL;
+
+    switch (heap->allocator) {
+        case DUKPY_ALLOC_POOL:
+        {
+            int sizeClass = dukpy_pool_class_for(size);
+            if (sizeClass != DUKPY_BLOCK_LARGE) {
+                hdr = dukpy_pool_alloc(heap, sizeClass);
+                break;
+            }
+
+            hdr = malloc(sizeof(union DukPyBlockHeader) + size);
+            if (hdr) {
+                hdr->info.kind = DUKPY_BLOCK_LARGE;
+            }
+        }
+        break;
+
+        case DUKPY_ALLOC_ARENA:
+        {
+            // big blocks (value stacks, string tables, large buffers) get
+            // resized a lot, so they're kept out of the arena
+            if (size < DUKPY_ARENA_CHUNK_SIZE / 8) {
+                hdr = dukpy_arena_alloc(heap, size);
+                break;
+            }
+
+            hdr = malloc(sizeof(union DukPyBlockHeader) + size);
+            if (hdr) {
+                hdr->info.kind = DUKPY_BLOCK_LARGE;
+            }
+        }
+        break;
+
+        case DUKPY_ALLOC_PYMEM:
+        default:
+        {
+            hdr = PyMem_Malloc(sizeof(union DukPyBlockHeader) + size);
+            if (hdr) {
+                hdr->info.kind = DUKPY_BLOCK_PYMEM;
+            }
+        }
+        break;
+    }
+
+    if (!hdr) {
+        return NULL;
+    }
+
+    hdr->info.size = size;
+    hdr->info.releaseOffset = 0;
+    if (hdr->info.kind == DUKPY_BLOCK_PYMEM || hdr->info.kind == DUKPY_BLOCK_LARGE) {
+        heap->reservedBytes += sizeof(union DukPyBlockHeader) + size;
+        heap->usedBytes += sizeof(union DukPyBlockHeader) + size;
+    }
+    return hdr;
+}
+
+static void dukpy_block_free(struct DukPyHeap* heap, union DukPyBlockHeader* hdr) {
+    size_t blockSize = dukpy_block_size(hdr);
+
+    switch (hdr->info.kind) {
+        case DUKPY_BLOCK_PYMEM:
+            heap->reservedBytes -= blockSize;
+            heap->usedBytes -= blockSize;
+            PyMem_Free(hdr);
+            break;
+
+        case DUKPY_BLOCK_LARGE:
+            heap->reservedBytes -= blockSize;
+            heap->usedBytes -= blockSize;
+            free(hdr);
+            break;
+
+        case DUKPY_BLOCK_ARENA:
+        {
+            // only the most recent block can be handed back, everything else
+            // waits for the whole arena to go away with the heap
+            size_t arenaSize = DUKPY_ARENA_ROUND(blockSize);
+            struct DukPyMemChunk* chunk = heap->chunks;
+            heap->usedBytes -= arenaSize;
+            if (chunk && (char*)hdr + arenaSize == (char*)chunk + chunk->used) {
+                chunk->used -= arenaSize;
+            }
+        }
+        break;
+
+        default:
+            heap->usedBytes -= blockSize;
+            DUKPY_NEXT_FREE(hdr) = heap->poolFree[hdr->info.kind];
+            heap->poolFree[hdr->info.kind] = hdr;
+            break;
+    }
+}
+
+static void dukpy_release_allocator(struct DukPyHeap* heap) {
+    struct DukPyMemChunk* chunk = heap->chunks;
+    while (chunk) {
+        struct DukPyMemChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    heap->chunks = NULL;
+}
+
+static union DukPyBlockHeader* dukpy_block_realloc(struct DukPyHeap* heap, union DukPyBlockHeader* hdr, size_t size) {
+    switch (hdr->info.kind) {
+        case DUKPY_BLOCK_PYMEM:
+        case DUKPY_BLOCK_LARGE:
+        {
+            size_t oldSize = hdr->info.size;
+            union DukPyBlockHeader* newHdr;
+            if (hdr->info.kind == DUKPY_BLOCK_PYMEM) {
+                newHdr = PyMem_Realloc(hdr, sizeof(union DukPyBlockHeader) + size);
+            } else {
+                newHdr = realloc(hdr, sizeof(union DukPyBlockHeader) + size);
+            }
+            if (!newHdr) {
+                return NULL;
+            }
+            newHdr->info.size = size;
+            heap->reservedBytes += size - oldSize;
+            heap->usedBytes += size - oldSize;
+            return newHdr;
+        }
+
+        case DUKPY_BLOCK_ARENA:
+        {
+            // grow or shrink in place if we're the last thing in the arena
+            struct DukPyMemChunk* chunk = heap->chunks;
+            size_t oldArenaSize = DUKPY_ARENA_ROUND(dukpy_block_size(hdr));
+            size_t newArenaSize = DUKPY_ARENA_ROUND(sizeof(union DukPyBlockHeader) + size);
+            if (size < DUKPY_ARENA_CHUNK_SIZE / 8 && chunk &&
+                (char*)hdr + oldArenaSize == (char*)chunk + chunk->used &&
+                chunk->used - oldArenaSize + newArenaSize <= chunk->size) {
+                chunk->used = chunk->used - oldArenaSize + newArenaSize;
+                heap->usedBytes = heap->usedBytes - oldArenaSize + newArenaSize;
+                hdr->info.size = size;
+                return hdr;
+            }
+        }
+        break;
+
+        default:
+            if (dukpy_pool_class_for(size) == hdr->info.kind) {
+                hdr->info.size = size;
+                return hdr;
+            }
+            break;
+    }
+
+    // no luck, move it somewhere else
+    union DukPyBlockHeader* newHdr = dukpy_block_alloc(heap, size);
+    if (!newHdr) {
+        return NULL;
+    }
+    memcpy(newHdr + 1, hdr + 1, hdr->info.size < size ? hdr->info.size : size);
+    dukpy_block_free(heap, hdr);
+    return newHdr;
+}
+
+static int dukpy_over_limit(struct DukPyHeap* heap, size_t growth) {
+    // The limit only applies while running protected calls: failing an
+    // allocation anywhere else throws an error nothing catches, and that's
+    // fatal. Our own glue code gets to go over the limit a little instead.
+    if (!heap->maxHeapBytes || !heap->protectedDepth || heap->liveBytes + growth <= heap->maxHeapBytes) {
+        return 0;
+    }
+
+    // Duktape will collect garbage and retry before giving up with an error,
+    // which dukpy_set_python_error_from_js_error turns into a MemoryError
+    heap->failedAllocs++;
+    heap->limitExceeded = 1;
+    return 1;
+}
+
+/*
+ * Scripts can catch the error a failed allocation throws and carry on, so
+ * limitExceeded alone doesn't mean the error at hand is that one.
+ */
+static int dukpy_is_alloc_error(duk_context *ctx, duk_idx_t index) {
+    if (!duk_is_error(ctx, index)) {
+        return 0;
+    }
+    duk_get_prop_string(ctx, index, "message");
+    const char* message = duk_get_string(ctx, -1);
+    int result = message && strcmp(message, "alloc failed") == 0;
+    duk_pop(ctx);
+    return result;
+}
+
+static void dukpy_account_block(struct DukPyHeap* heap, size_t oldSize, size_t newSize) {
+    heap->liveBytes = heap->liveBytes - oldSize + newSize;
+    if (heap->liveBytes > heap->peakBytes) {
+        heap->peakBytes = heap->liveBytes;
+    }
+}
+
 static void* dukpy_malloc(void *udata, duk_size_t size) {
-    UNUSED(udata);
+    struct DukPyHeap* heap = (struct DukPyHeap*)udata;
+    if (dukpy_over_limit(heap, size)) {
+        return NULL;
+    }
+    heap->bytesSinceGC += size;
 
-    return PyMem_Malloc(size);
+    union DukPyBlockHeader* hdr = dukpy_block_alloc(heap, size);
+    if (!hdr) {
+        heap->failedAllocs++;
+        return NULL;
+    }
+    heap->allocCount++;
+    dukpy_account_block(heap, 0, size);
+    return hdr + 1;
 }
 static void* dukpy_realloc(void *udata, void *ptr, duk_size_t size) {
-    UNUSED(udata);
-    
-    return PyMem_Realloc(ptr, size);
+    struct DukPyHeap* heap = (struct DukPyHeap*)udata;
+
+    if (!ptr) {
+        return dukpy_malloc(udata, size);
+    }
+
+    union DukPyBlockHeader* hdr = ((union DukPyBlockHeader*)ptr) - 1;
+    size_t oldSize = hdr->info.size;
+    if (size > oldSize && dukpy_over_limit(heap, size - oldSize)) {
+        return NULL;
+    }
+    heap->bytesSinceGC += size;
+
+    union DukPyBlockHeader* newHdr = dukpy_block_realloc(heap, hdr, size);
+    if (!newHdr) {
+        heap->failedAllocs++;
+        return NULL;
+    }
+    heap->reallocCount++;
+    dukpy_account_block(heap, oldSize, size);
+    return newHdr + 1;
+}
+/*
+ * Python objects referenced from JavaScript are kept alive by a small fixed
+ * buffer hanging off their wrapper, holding the references (see
+ * dukpy_push_release_slots). When Duktape frees such a buffer we only queue
+ * the references here: dropping them could run arbitrary Python code, which
+ * mustn't happen in the middle of a Duktape collection. The queue is drained
+ * once we're back outside Duktape, by dukpy_drain_releases.
+ *
+ * This replaces a Duktape finalizer per wrapper, which made refcount and
+ * mark-and-sweep collection take their much slower finalizer paths.
+ */
+static void dukpy_queue_release(struct DukPyHeap* heap, union DukPyBlockHeader* hdr) {
+    PyObject** slots = (PyObject**)((char*)(hdr + 1) + hdr->info.releaseOffset);
+    size_t count = (hdr->info.size - hdr->info.releaseOffset) / sizeof(PyObject*);
+
+    for (size_t i = 0; i < count; i++) {
+        if (!slots[i]) {
+            continue;
+        }
+        if (heap->releaseCount == heap->releaseCapacity) {
+            size_t capacity = heap->releaseCapacity ? heap->releaseCapacity * 2 : 64;
+            PyObject** queue = realloc(heap->releaseQueue, capacity * sizeof(PyObject*));
+            if (!queue) {
+                // better to drop it now than to leak it
+                Py_DECREF(slots[i]);
+                continue;
+            }
+            heap->releaseQueue = queue;
+            heap->releaseCapacity = capacity;
+        }
+        heap->releaseQueue[heap->releaseCount++] = slots[i];
+    }
+}
+
+static void dukpy_drain_releases(struct DukPyHeap* heap) {
+    if (!heap->releaseCount) {
+        return;
+    }
+    heap->releaseBatches++;
+
+    // releasing may run Python code that queues more, so pop one at a time
+    while (heap->releaseCount) {
+        PyObject* obj = heap->releaseQueue[--heap->releaseCount];
+        heap->releasedRefs++;
+        Py_DECREF(obj);
+    }
+}
+
+/*
+ * Every API entry point calls this once it has popped whatever it pushed, so
+ * that Python objects which only lived for the call (the evaljs variables, an
+ * exception thrown through JavaScript, ...) are released before we return.
+ * Inside Duktape, e.g. a nested call from a Python callback, the outermost
+ * call takes care of it.
+ */
+static void dukpy_release_now(duk_context *ctx) {
+    struct DukPyHeap* heap = dukpy_get_heap(ctx);
+    if (heap->protectedDepth || !heap->releaseCount) {
+        return;
+    }
+
+    // finalizers mustn't see or clobber an error we're about to raise
+    PyObject *type, *value, *traceback;
+    PyErr_Fetch(&type, &value, &traceback);
+    dukpy_drain_releases(heap);
+    PyErr_Restore(type, value, traceback);
 }
+
 static void dukpy_free(void *udata, void *ptr) {
-    UNUSED(udata);
+    struct DukPyHeap* heap = (struct DukPyHeap*)udata;
+
+    if (!ptr) {
+        return;
+    }
 
-    PyMem_Free(ptr);
+    union DukPyBlockHeader* hdr = ((union DukPyBlockHeader*)ptr) - 1;
+    if (hdr->info.releaseOffset) {
+        dukpy_queue_release(heap, hdr);
+    }
+    heap->freeCount++;
+    dukpy_account_block(heap, hdr->info.size, 0);
+    dukpy_block_free(heap, hdr);
 }
 static void dukpy_fatal(duk_context *ctx, duk_errcode_t code, const char *msg) {
     PyErr_SetString(PyExc_RuntimeError, msg);
@@ -274,6 +849,113 @@ static duk_context* dukpy_ensure_valid_ctx(PyObject* pyctx) {
     return ctx;
 }
 
+/*
+ * dukpy_exec_timeout_check lets other threads run while JavaScript does, so
+ * that they can call interrupt(). Anything else they'd do with the context
+ * would corrupt the heap under the running code, so it's refused.
+ */
+static int dukpy_other_thread_running(struct DukPyHeap* heap) {
+    return heap->protectedDepth && heap->owner != (unsigned long)PyThread_get_thread_ident();
+}
+
+static int dukpy_check_owner(duk_context *ctx) {
+    if (dukpy_other_thread_running(dukpy_get_heap(ctx))) {
+        PyErr_SetString(PyExc_RuntimeError, "the context is running JavaScript in another thread");
+        return 0;
+    }
+    return 1;
+}
+
+static duk_context* dukpy_claim_ctx(PyObject* pyctx) {
+    duk_context *ctx = dukpy_ensure_valid_ctx(pyctx);
+    if (!ctx) {
+        PyErr_SetString(PyExc_ValueError, "must provide a duk_context");
+        return NULL;
+    }
+    return dukpy_check_owner(ctx) ? ctx : NULL;
+}
+
+static void dukpy_run_gc(duk_context *ctx, struct DukPyHeap* heap, int compact) {
+    double start = dukpy_now();
+
+    duk_gc(ctx, 0);
+    if (compact) {
+        // objects with finalizers only go away on the second pass
+        duk_gc(ctx, 0);
+
+        duk_push_global_object(ctx);
+        duk_compact(ctx, -1);
+        duk_pop(ctx);
+        duk_push_global_stash(ctx);
+        duk_compact(ctx, -1);
+        duk_pop(ctx);
+    }
+
+    heap->gcTime += dukpy_now() - start;
+    heap->gcCount++;
+    heap->evalsSinceGC = 0;
+    heap->bytesSinceGC = 0;
+
+    if (!heap->protectedDepth) {
+        dukpy_drain_releases(heap);
+    }
+}
+
+static void dukpy_maybe_gc(duk_context *ctx) {
+    // Duktape's refcounting and voluntary mark-and-sweep keep the heap tidy on
+    // their own, so this only adds forced collections when asked to
+    struct DukPyHeap* heap = dukpy_get_heap(ctx);
+    heap->evalsSinceGC++;
+
+    switch (heap->gcPolicy) {
+        case DUKPY_GC_EVERY:
+            if (heap->evalsSinceGC >= heap->gcInterval) {
+                dukpy_run_gc(ctx, heap, 0);
+            }
+            break;
+
+        case DUKPY_GC_THRESHOLD:
+            if (heap->bytesSinceGC >= heap->gcThreshold) {
+                dukpy_run_gc(ctx, heap, 0);
+            }
+            break;
+
+        case DUKPY_GC_NEVER:
+        default:
+            break;
+    }
+}
+
+static void dukpy_add_orphan_handle(struct DukPyHeap* heap, const char* name) {
+    if (heap->orphanCount == heap->orphanCapacity) {
+        size_t capacity = heap->orphanCapacity ? heap->orphanCapacity * 2 : 16;
+        char** orphans = realloc(heap->orphanHandles, capacity * sizeof(char*));
+        if (!orphans) {
+            // leaking the stash entry is the lesser evil
+            free((void*)name);
+            return;
+        }
+        heap->orphanHandles = orphans;
+        heap->orphanCapacity = capacity;
+    }
+    heap->orphanHandles[heap->orphanCount++] = (char*)name;
+}
+
+static void dukpy_delete_orphan_handles(struct DukPyHeap* heap) {
+    if (!heap->orphanCount) {
+        return;
+    }
+
+    duk_context *ctx = heap->ctx;
+    duk_push_global_stash(ctx); // [... gstash]
+    for (size_t i = 0; i < heap->orphanCount; i++) {
+        duk_del_prop_string(ctx, -1, heap->orphanHandles[i]);
+        free(heap->orphanHandles[i]);
+    }
+    duk_pop(ctx); // [...]
+    heap->orphanCount = 0;
+}
+
 static void dukpy_destroy_pyctx(PyObject* pyctx) {
     DUKPY_DEBUG_PRINT("destroying pyctx\n");
     duk_context *ctx = dukpy_ensure_valid_ctx(pyctx);
@@ -282,6 +964,8 @@ static void dukpy_destroy_pyctx(PyObject* pyctx) {
         return;
     }
 
+    struct DukPyHeap* heap = dukpy_get_heap(ctx);
+
     DUKPY_DEBUG_PRINT("OK, destroying pyJSObject...\n");
 
     duk_push_global_stash(ctx); // [... gstash]
@@ -294,6 +978,19 @@ static void dukpy_destroy_pyctx(PyObject* pyctx) {
     DUKPY_DEBUG_PRINT("OK, destroying heap!\n");
 
     duk_destroy_heap(ctx);
+    dukpy_drain_releases(heap);
+    free(heap->releaseQueue);
+    for (size_t i = 0; i < heap->orphanCount; i++) {
+        free(heap->orphanHandles[i]);
+    }
+    free(heap->orphanHandles);
+    dukpy_release_allocator(heap);
+    Py_CLEAR(heap->abortType);
+    Py_CLEAR(heap->abortValue);
+    Py_CLEAR(heap->abortTraceback);
+    Py_CLEAR(heap->profileSamples);
+    Py_CLEAR(heap->moduleLoader);
+    free(heap);
 
     DUKPY_DEBUG_PRINT("We're outta here.");
 }
@@ -323,6 +1020,18 @@ static void dukpy_function_destructor(PyObject* pyfunc) {
 
     DUKPY_DEBUG_PRINT("destructing function\n");
 
+    struct DukPyHeap* heap = dukpy_get_heap(dpf->ctx);
+    if (dukpy_other_thread_running(heap)) {
+        // the stash is off limits, the running thread deletes the entry later
+        PyObject* pyctx = heap->pyctx;
+        dukpy_add_orphan_handle(heap, dpf->name);
+        free((void*)dpf);
+        Py_XDECREF(pyctx);
+        return;
+    }
+
+    DUKPY_STAT_INC(dpf->ctx, handlesReleased);
+
     duk_push_global_stash(dpf->ctx); // [... gstash]
     duk_del_prop_string(dpf->ctx, -1, dpf->name); // [... gstash]
     duk_get_prop_string(dpf->ctx, -1, "pydukPyCTX"); // [... gstash pyctx]
@@ -330,6 +1039,11 @@ static void dukpy_function_destructor(PyObject* pyfunc) {
     duk_pop(dpf->ctx); // [... gstash]
     duk_pop(dpf->ctx); // [...]
 
+    if (!heap->protectedDepth) {
+        // deleting the stash entry may have let go of wrappers
+        dukpy_drain_releases(heap);
+    }
+
     free((void*)dpf->name);
     dpf->name = NULL;
     free((void*)dpf);
@@ -345,6 +1059,7 @@ static PyObject* dukpy_pyobj_from_stack(duk_context *ctx, int pos, PyObject* see
     if (PyDict_Contains(seen, kkey)) {
         PyObject* ret = PyDict_GetItem(seen, kkey);
         Py_DECREF(kkey);
+        Py_INCREF(ret);
         return ret;
     }
 
@@ -354,12 +1069,14 @@ static PyObject* dukpy_pyobj_from_stack(duk_context *ctx, int pos, PyObject* see
         case DUK_TYPE_NULL:
         {
             Py_DECREF(kkey);
+            DUKPY_STAT_INC(ctx, toPyNone);
             Py_RETURN_NONE;
         }
 
         case DUK_TYPE_BOOLEAN:
         {
             Py_DECREF(kkey);
+            DUKPY_STAT_INC(ctx, toPyBool);
             int val = duk_get_boolean(ctx, pos);
             if (val) {
                 Py_RETURN_TRUE;
@@ -373,36 +1090,20 @@ static PyObject* dukpy_pyobj_from_stack(duk_context *ctx, int pos, PyObject* see
             Py_DECREF(kkey);
 
             // is this int-y enough for us to try and int cast?
-            duk_push_string(ctx, "(function(n) { return Math.round(n) == n })");
-            duk_peval(ctx);
-            if (pos < 0) {
-                duk_dup(ctx, pos - 1);
-            } else {
-                duk_dup(ctx, pos);
-            }
-            duk_call(ctx, 1);
-            duk_bool_t res = duk_require_boolean(ctx, -1);
-            duk_pop(ctx);
-
-            if (res) {
-                // try the int cast
-                {
-                    duk_int_t val = duk_get_int(ctx, pos);
-                    if (val > DUK_INT_MIN && val < DUK_INT_MAX) {
-                        return PyLong_FromLong(val);
-                    }
+            double num = duk_get_number(ctx, pos);
+            if (num == floor(num)) {
+                if (num > DUK_INT_MIN && num < DUK_INT_MAX) {
+                    DUKPY_STAT_INC(ctx, toPyInt);
+                    return PyLong_FromLong((long)num);
                 }
-
-                // try the uint cast?
-                {
-                    duk_uint_t val = duk_get_uint(ctx, pos);
-                    if (val > DUK_UINT_MIN && val < DUK_UINT_MAX) {
-                        return PyLong_FromUnsignedLong(val);
-                    }
+                if (num > DUK_UINT_MIN && num < DUK_UINT_MAX) {
+                    DUKPY_STAT_INC(ctx, toPyInt);
+                    return PyLong_FromUnsignedLong((unsigned long)num);
                 }
             }
 
             double val = duk_get_number(ctx, pos);
+            DUKPY_STAT_INC(ctx, toPyFloat);
             return PyFloat_FromDouble(val);
         }
 
@@ -410,6 +1111,8 @@ static PyObject* dukpy_pyobj_from_stack(duk_context *ctx, int pos, PyObject* see
         {
             Py_DECREF(kkey);
             const char* val = duk_get_string(ctx, pos);
+            DUKPY_STAT_INC(ctx, toPyString);
+            DUKPY_STAT_ADD(ctx, stringBytesToPy, strlen(val));
             return dukpy_char_to_nstring(val);
         }
 
@@ -422,10 +1125,13 @@ static PyObject* dukpy_pyobj_from_stack(duk_context *ctx, int pos, PyObject* see
             if (ptr != NULL) {
                 PyObject* val = ptr;
                 Py_INCREF(val);
+                DUKPY_STAT_INC(ctx, toPyOther);
                 return val;
             }
 
             // hoo boy
+            DUKPY_STAT_INC(ctx, toPyJSObject);
+            DUKPY_STAT_INC(ctx, handlesCreated);
             duk_dup(ctx, pos); // [... func]
             duk_push_global_stash(ctx); // [... func gstash]
             struct DukPyFunction* dpf = dukpy_generate_function(ctx);
@@ -469,6 +1175,7 @@ static PyObject* dukpy_pyobj_from_stack(duk_context *ctx, int pos, PyObject* see
             // hooray
             duk_size_t size = 0;
             void* val = duk_get_buffer(ctx, pos, &size);
+            DUKPY_STAT_INC(ctx, toPyBytes);
             return PyBytes_FromStringAndSize((const char*)val, size);
         }
 
@@ -477,6 +1184,7 @@ static PyObject* dukpy_pyobj_from_stack(duk_context *ctx, int pos, PyObject* see
             Py_DECREF(kkey);
             // err
             void* val = duk_get_pointer(ctx, pos);
+            DUKPY_STAT_INC(ctx, toPyOther);
             return PyCapsule_New(val, DUKPY_PTR_CAPSULE_NAME, NULL);
         }
 
@@ -485,45 +1193,26 @@ static PyObject* dukpy_pyobj_from_stack(duk_context *ctx, int pos, PyObject* see
         {
             Py_DECREF(kkey);
             // ???
+            DUKPY_STAT_INC(ctx, toPyOther);
             return dukpy_char_to_nstring(duk_safe_to_string(ctx, pos));                    
         }
     }
 }
 
-static duk_ret_t dukpy_err_finalizer(duk_context *ctx) {
-
-    DUKPY_DEBUG_PRINT("Finalizing error!\n");
-
-    duk_get_prop_string(ctx, 0, DUKPY_INTERNAL_PROPERTY "_ptrtype");
-    if (duk_is_pointer(ctx, -1)) {
-        PyObject* obj = duk_require_pointer(ctx, -1);
-        DUKPY_DEBUG_PRINT("...ptrtype\n");
-        DUKPY_DEBUG_PRINT_REPR(obj);
-        Py_DECREF(obj);
-    }
-    duk_pop(ctx);
-
-    duk_get_prop_string(ctx, 0, DUKPY_INTERNAL_PROPERTY "_ptrinst");
-    if (duk_is_pointer(ctx, -1)) {
-        PyObject* obj = duk_require_pointer(ctx, -1);
-        DUKPY_DEBUG_PRINT("...ptrinst\n");
-        DUKPY_DEBUG_PRINT_REPR(obj);
-        Py_DECREF(obj);
-    }
-    duk_pop(ctx);
-
-    duk_get_prop_string(ctx, 0, DUKPY_INTERNAL_PROPERTY "_ptrtb");
-    if (duk_is_pointer(ctx, -1)) {
-        PyObject* obj = duk_require_pointer(ctx, -1);
-        DUKPY_DEBUG_PRINT("...ptrtb\n");
-        DUKPY_DEBUG_PRINT_REPR(obj);
-        Py_DECREF(obj);
-    }
-    duk_pop(ctx);
-
-    DUKPY_DEBUG_PRINT("Finalizing error done.\n");
-
-    return 0;
+/*
+ * Pushes a fixed buffer holding count references, which are handed over
+ * to it. Fixed buffers are allocated in one piece, so the buffer's heap
+ * pointer is the block dukpy_malloc handed out and the references sit at
+ * its end; marking the block header is enough for dukpy_free to queue
+ * them once the buffer, and so whatever it's attached to, is gone.
+ */
+static void dukpy_push_release_slots(duk_context *ctx, PyObject** refs, int count) {
+    PyObject** slots = (PyObject**)duk_push_fixed_buffer(ctx, count * sizeof(PyObject*));
+    memcpy(slots, refs, count * sizeof(PyObject*));
+
+    char* block = (char*)duk_get_heapptr(ctx, -1);
+    union DukPyBlockHeader* hdr = ((union DukPyBlockHeader*)block) - 1;
+    hdr->info.releaseOffset = (int)((char*)slots - block);
 }
 
 static duk_errcode_t dukpy_python_error_to_errcode(PyObject* exctype) {
@@ -557,8 +1246,10 @@ static duk_ret_t dukpy_push_current_python_error(duk_context *ctx) {
     } else {
         duk_push_error_object(ctx, errc, "error occurred translating Python error");
     }
-    duk_push_c_function(ctx, dukpy_err_finalizer, 1); // [err finalizer]
-    duk_set_finalizer(ctx, -2); // [err]
+    // the error holds on to our references until it's collected
+    PyObject* refs[3] = {exctype, excinst, exctb};
+    dukpy_push_release_slots(ctx, refs, 3); // [err slots]
+    duk_put_prop_string(ctx, -2, DUKPY_INTERNAL_PROPERTY "_refs"); // [err]
     if (exctype) {
         duk_push_pointer(ctx, exctype);
         duk_put_prop_string(ctx, -2, DUKPY_INTERNAL_PROPERTY "_ptrtype");
@@ -583,6 +1274,7 @@ static void dukpy_set_python_error_from_js_error(duk_context *ctx) {
         // don't override set error indicator!
         // something else maybe happened during our error handling?
         duk_pop(ctx);
+        dukpy_release_now(ctx);
         return;
     }
 
@@ -609,31 +1301,41 @@ static void dukpy_set_python_error_from_js_error(duk_context *ctx) {
     }
     duk_pop(ctx);
 
+    struct DukPyHeap* heap = dukpy_get_heap(ctx);
+
     if (exctype) {
         Py_XINCREF(exctype);
         Py_XINCREF(excinst);
         Py_XINCREF(exctb);
         // we're giving PyErr_Restore a reference
         PyErr_Restore(exctype, excinst, exctb);
+    } else if (heap->abortReason == DUKPY_ABORT_PYERR) {
+        // a signal handler raised while we were running, hand it on as-is
+        PyErr_Restore(heap->abortType, heap->abortValue, heap->abortTraceback);
+        heap->abortType = heap->abortValue = heap->abortTraceback = NULL;
+    } else if (heap->abortReason == DUKPY_ABORT_INTERRUPTED) {
+        PyErr_SetString(DukPyInterruptedError, "JavaScript execution interrupted");
+    } else if (heap->abortReason == DUKPY_ABORT_TIMEOUT) {
+        PyErr_SetString(DukPyTimeoutError, "JavaScript execution timed out");
+    } else if (heap->abortReason == DUKPY_ABORT_CPU_TIMEOUT) {
+        PyErr_SetString(DukPyTimeoutError, "JavaScript execution exceeded its CPU time budget");
+    } else if (heap->limitExceeded && dukpy_is_alloc_error(ctx, -1)) {
+        PyErr_Format(PyExc_MemoryError, "JavaScript heap limit of %zu bytes exceeded: %s",
+            heap->maxHeapBytes, duk_safe_to_string(ctx, -1));
     } else {
         PyErr_SetString(DukPyError, duk_safe_to_string(ctx, -1));
     }
+    if (!heap->protectedDepth) {
+        heap->limitExceeded = 0;
+    }
+    heap->abortReason = DUKPY_ABORT_NONE;
+    Py_CLEAR(heap->abortType);
+    Py_CLEAR(heap->abortValue);
+    Py_CLEAR(heap->abortTraceback);
     duk_pop(ctx); // get rid of error
+    dukpy_release_now(ctx);
 }
 
-static duk_ret_t dukpy_callable_finalizer(duk_context *ctx) {
-    duk_get_prop_string(ctx, 0, DUKPY_INTERNAL_PROPERTY "_ptr");
-    void* ptr = duk_require_pointer(ctx, -1);
-
-    DUKPY_DEBUG_PRINT("Finalizing %p:\n", ptr);
-    DUKPY_DEBUG_PRINT_REPR(ptr);
-
-    Py_XDECREF((PyObject*)ptr);
-    duk_pop_2(ctx);
-
-    DUKPY_DEBUG_PRINT("Finalizer on %p done.\n", ptr);
-    return 0;
-}
 static duk_ret_t dukpy_callable_handler(duk_context *ctx) { 
     void* ptr = duk_require_pointer(ctx, -1);
     duk_pop(ctx);
@@ -654,7 +1356,11 @@ static duk_ret_t dukpy_callable_handler(duk_context *ctx) {
     Py_DECREF(seen);
 
     // call!
+    DUKPY_STAT_INC(ctx, pyCalls);
+    DUKPY_STAT_TIMER_START(callStart);
     PyObject* ret = PyObject_Call(fptr, argTuple, NULL);
+    DUKPY_STAT_TIMER_STOP(ctx, callbackTime, callStart);
+    Py_DECREF(argTuple);
     if (ret == NULL) {
         // something went wrong :(
         dukpy_push_current_python_error(ctx);
@@ -678,8 +1384,8 @@ static void dukpy_create_pyptrobj(duk_context *ctx, PyObject* obj) {
     DUKPY_DEBUG_PRINT_REPR(obj);
 
 
-    duk_push_c_function(ctx, dukpy_callable_finalizer, 1); // [obj finalizer]
-    duk_set_finalizer(ctx, -2); // [obj]
+    dukpy_push_release_slots(ctx, &obj, 1); // [obj slots]
+    duk_put_prop_string(ctx, -2, DUKPY_INTERNAL_PROPERTY "_refs"); // [obj]
 }
 static void dukpy_generate_callable_func(duk_context *ctx, PyObject* obj) {
     duk_peval_string(ctx, "(function(fnc, ptr) { return function() { var args = Array.prototype.slice.call(arguments); args.push(ptr); return fnc.apply(this, args) }; })"); // [wf]
@@ -756,7 +1462,12 @@ static int dukpy_jswrapped_unwrap(duk_context *ctx, PyObject* obj) {
     return 1;
 }
 
+/*
+ * Takes over the caller's reference to obj if it succeeds: wrappers keep it
+ * until they're finalized, values that get copied into the heap drop it.
+ */
 static int dukpy_wrap_a_python_object_somehow_and_return_it(duk_context *ctx, PyObject* obj) {
+    int keepsReference = 0;
     if (DUKPY_IS_NSTRING(obj)) {
         const char* val = dukpy_nstring_to_char(obj);
         if (!val) {
@@ -764,9 +1475,25 @@ static int dukpy_wrap_a_python_object_somehow_and_return_it(duk_context *ctx, Py
         }
 
         duk_push_string(ctx, val);
+        DUKPY_STAT_INC(ctx, toJSString);
+        DUKPY_STAT_ADD(ctx, stringBytesToJS, strlen(val));
+#if PY_MAJOR_VERSION < 3
+    } else if (PyUnicode_Check(obj)) {
+        // so callers don't have to encode text themselves on Python 2
+        PyObject* utf8 = PyUnicode_AsUTF8String(obj);
+        if (!utf8) {
+            return 0;
+        }
+        duk_push_lstring(ctx, PyString_AS_STRING(utf8), PyString_GET_SIZE(utf8));
+        DUKPY_STAT_INC(ctx, toJSString);
+        DUKPY_STAT_ADD(ctx, stringBytesToJS, PyString_GET_SIZE(utf8));
+        Py_DECREF(utf8);
+#endif
     } else if (obj == Py_None) {
         duk_push_null(ctx);
+        DUKPY_STAT_INC(ctx, toJSNull);
     } else if (PyBool_Check(obj)) {
+        DUKPY_STAT_INC(ctx, toJSBool);
         if (PyObject_RichCompareBool(obj, Py_True, Py_EQ) == 1) {
             duk_push_true(ctx);
         } else {
@@ -775,17 +1502,26 @@ static int dukpy_wrap_a_python_object_somehow_and_return_it(duk_context *ctx, Py
     } else if (PyNumber_Check(obj)) {
         double val = PyFloat_AsDouble(obj);
         duk_push_number(ctx, val);
+        DUKPY_STAT_INC(ctx, toJSNumber);
     } else if (dukpy_jswrapped_unwrap(ctx, obj) == 1) {
-        return 1;
+        DUKPY_STAT_INC(ctx, toJSUnwrapped);
     } else if (PyCallable_Check(obj)) {
         dukpy_generate_callable_func(ctx, obj);
+        DUKPY_STAT_INC(ctx, toJSCallable);
+        keepsReference = 1;
     } else {
+        DUKPY_STAT_INC(ctx, toJSProxy);
+        keepsReference = 1;
         duk_push_object(ctx);
         dukpy_create_pyptrobj(ctx, obj);
         dukpy_create_objwrap(ctx);
         duk_push_pointer(ctx, obj); // [proxy objptr]
         duk_put_prop_string(ctx, -2, DUKPY_INTERNAL_PROPERTY "_ptr"); // [proxy]
     }
+
+    if (!keepsReference) {
+        Py_DECREF(obj);
+    }
     return 1;
 }
 static int dukpy_push_a_python_sequence_somehow_and_return_the_count(duk_context *ctx, PyObject* obj) {
@@ -806,7 +1542,7 @@ static int dukpy_push_a_python_sequence_somehow_and_return_the_count(duk_context
             return i;
         }
         i += pushedThisTime;
-        // we don't DECREF here because the reference is now owned by the JS engine
+        // we don't DECREF here, the wrapping took over our reference
     }
 
     Py_DECREF(pymyarglist);
@@ -843,6 +1579,7 @@ static duk_ret_t dukpy_objwrap_toString(duk_context *ctx) {
 }
 static duk_ret_t dukpy_objwrap_get(duk_context *ctx) {
     // arguments: [wrappedObj key recv]
+    DUKPY_STAT_INC(ctx, trapGet);
     duk_pop(ctx); // we don't care about recv
 
     PyObject* v = dukpy_get_objwrap_pyobj(ctx, -2);
@@ -908,6 +1645,7 @@ static duk_ret_t dukpy_objwrap_get(duk_context *ctx) {
 }
 static duk_ret_t dukpy_objwrap_set(duk_context *ctx) {
     // arguments: [wrappedObj key newVal recv]
+    DUKPY_STAT_INC(ctx, trapSet);
     PyObject* v = dukpy_get_objwrap_pyobj(ctx, -4);
     duk_pop(ctx); // don't want recv
 
@@ -971,6 +1709,7 @@ static duk_ret_t dukpy_objwrap_set(duk_context *ctx) {
 }
 static duk_ret_t dukpy_objwrap_has(duk_context *ctx) {
     // arguments: [wrappedObj key]
+    DUKPY_STAT_INC(ctx, trapHas);
     PyObject* v = dukpy_get_objwrap_pyobj(ctx, -2);
 
     int result = -1;
@@ -1021,6 +1760,7 @@ static duk_ret_t dukpy_objwrap_has(duk_context *ctx) {
 }
 static duk_ret_t dukpy_objwrap_deleteProperty(duk_context *ctx) {
     // arguments: [wrappedObj key]
+    DUKPY_STAT_INC(ctx, trapDelete);
     PyObject* v = dukpy_get_objwrap_pyobj(ctx, -2);
 
     int status = -1;
@@ -1076,6 +1816,7 @@ static duk_ret_t dukpy_objwrap_deleteProperty(duk_context *ctx) {
 }
 static duk_ret_t dukpy_objwrap_enumerate_core(duk_context *ctx, int allowDir) {
     // arguments: [wrappedObj]
+    DUKPY_STAT_INC(ctx, trapEnumerate);
     PyObject* v = dukpy_get_objwrap_pyobj(ctx, -1);
     duk_pop(ctx);
 
@@ -1194,21 +1935,38 @@ static duk_ret_t dukpy_objwrap_ownKeys(duk_context *ctx) {
 
 static PyObject *DukPy_create_context(PyObject *self, PyObject *args) {
     PyObject *pyJSObject;
+    int allocator = DUKPY_ALLOC_PYMEM;
 
-    if (!PyArg_ParseTuple(args, "O", &pyJSObject))
+    if (!PyArg_ParseTuple(args, "O|i", &pyJSObject, &allocator))
         return NULL;
 
+    if (allocator < DUKPY_ALLOC_PYMEM || allocator > DUKPY_ALLOC_ARENA) {
+        PyErr_SetString(PyExc_ValueError, "unknown allocator");
+        return NULL;
+    }
+
+    struct DukPyHeap* heap = calloc(sizeof(struct DukPyHeap), 1);
+    if (!heap) {
+        return PyErr_NoMemory();
+    }
+    heap->allocator = allocator;
+    heap->gcPolicy = DUKPY_GC_NEVER;
+    heap->gcInterval = 1;
+
     duk_context *ctx = duk_create_heap(
         &dukpy_malloc,
         &dukpy_realloc,
         &dukpy_free,
-        NULL,
+        heap,
         &dukpy_fatal
     );
     if (!ctx) {
+        dukpy_release_allocator(heap);
+        free(heap);
         PyErr_SetString(PyExc_RuntimeError, "allocating duk_context");
         return NULL;
     }
+    heap->ctx = ctx;
 
     // we need to set up our object wrapper here
     duk_push_global_stash(ctx); // [gstash]
@@ -1242,7 +2000,14 @@ static PyObject *DukPy_create_context(PyObject *self, PyObject *args) {
     // and finalise up
     duk_put_prop_string(ctx, -2, "pydukObjWrapper"); // [gstash]
 
+    // what the profiler walks the callstack with
+    duk_get_global_string(ctx, "Duktape"); // [gstash Duktape]
+    duk_get_prop_string(ctx, -1, "act"); // [gstash Duktape act]
+    duk_put_prop_string(ctx, -3, "dukpyAct"); // [gstash Duktape]
+    duk_pop(ctx); // [gstash]
+
     PyObject* pyctx = PyCapsule_New(ctx, DUKPY_CONTEXT_CAPSULE_NAME, &dukpy_destroy_pyctx);
+    heap->pyctx = pyctx;
     DUKPY_DEBUG_PRINT("pyctx is at %p, ctx is at %p\n", pyctx, ctx);
     duk_push_pointer(ctx, pyctx); // [gstash pyctx]
     duk_put_prop_string(ctx, -2, "pydukPyCTX"); // [gstash]
@@ -1257,199 +2022,2001 @@ static PyObject *DukPy_create_context(PyObject *self, PyObject *args) {
     return pyctx;
 }
 
-static PyObject *DukPy_eval_string_ctx(PyObject *self, PyObject *args) {
-    PyObject *pyctx;
-    const char *command;
-    PyObject *pyvars;
+struct DukPyChunk {
+    const char* data;
+    Py_ssize_t len;
+    const char* filename;
+    PyObject* owned;
+    Py_buffer view;
+    int hasView;
+};
 
-    if (!PyArg_ParseTuple(args, "OsO", &pyctx, &command, &pyvars))
-        return NULL;
+static int dukpy_chunk_from_pyobj(struct DukPyChunk* chunk, PyObject* obj) {
+    memset(chunk, 0, sizeof(struct DukPyChunk));
+    chunk->filename = "input";
 
-    duk_context *ctx = dukpy_ensure_valid_ctx(pyctx);
-    if (!ctx) {
-        PyErr_SetString(PyExc_ValueError, "must provide a duk_context");
-        return NULL;
+    // (filename, source) pairs name their own compilation unit
+    if (PyTuple_Check(obj) && PyTuple_GET_SIZE(obj) == 2) {
+        PyObject* pyfilename = PyTuple_GET_ITEM(obj, 0);
+        if (!DUKPY_IS_NSTRING(pyfilename)) {
+            PyErr_SetString(PyExc_TypeError, "chunk filename must be a string");
+            return 0;
+        }
+        chunk->filename = dukpy_nstring_to_char(pyfilename);
+        if (!chunk->filename) {
+            return 0;
+        }
+        obj = PyTuple_GET_ITEM(obj, 1);
     }
 
-    duk_gc(ctx, 0);
+#if PY_MAJOR_VERSION >= 3
+    if (PyUnicode_Check(obj)) {
+        chunk->data = PyUnicode_AsUTF8AndSize(obj, &chunk->len);
+        return chunk->data != NULL;
+    }
+#else
+    if (PyUnicode_Check(obj)) {
+        chunk->owned = PyUnicode_AsUTF8String(obj);
+        if (!chunk->owned) {
+            return 0;
+        }
+        obj = chunk->owned;
+    }
+    if (PyString_Check(obj)) {
+        char* data = NULL;
+        if (PyString_AsStringAndSize(obj, &data, &chunk->len) < 0) {
+            return 0;
+        }
+        chunk->data = data;
+        return 1;
+    }
+#endif
+
+    // bytes, bytearray, mmap and anything else exposing a buffer is handed
+    // to the compiler as-is, so it had better be UTF-8
+    if (PyObject_GetBuffer(obj, &chunk->view, PyBUF_SIMPLE) < 0) {
+        PyErr_Clear();
+        PyErr_SetString(PyExc_TypeError, "chunks must be strings, bytes or buffers");
+        return 0;
+    }
+    chunk->hasView = 1;
+    chunk->data = (const char*)chunk->view.buf;
+    chunk->len = chunk->view.len;
+    return 1;
+}
+
+static void dukpy_chunk_release(struct DukPyChunk* chunk) {
+    if (chunk->hasView) {
+        PyBuffer_Release(&chunk->view);
+        chunk->hasView = 0;
+    }
+    Py_CLEAR(chunk->owned);
+}
+
+struct DukPyMappedFile {
+    const char* data;
+    size_t len;
+    void* map;
+    size_t maplen;
+};
+
+static int dukpy_map_file(struct DukPyMappedFile* mf, const char* path) {
+    memset(mf, 0, sizeof(struct DukPyMappedFile));
+    mf->data = "";
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+        close(fd);
+        return 0;
+    }
+
+    // mmap refuses zero-length mappings, but an empty file is still a valid script
+    if (st.st_size > 0) {
+        void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+            close(fd);
+            return 0;
+        }
+        mf->map = map;
+        mf->maplen = st.st_size;
+        mf->data = (const char*)map;
+        mf->len = st.st_size;
+    }
+    close(fd);
+
+    // the lexer doesn't want to see a UTF-8 byte order mark
+    if (mf->len >= 3 && memcmp(mf->data, "\xef\xbb\xbf", 3) == 0) {
+        mf->data += 3;
+        mf->len -= 3;
+    }
+    return 1;
+}
+
+static void dukpy_unmap_file(struct DukPyMappedFile* mf) {
+    if (mf->map) {
+        munmap(mf->map, mf->maplen);
+        mf->map = NULL;
+    }
+}
 
+static int dukpy_push_eval_vars(duk_context *ctx, PyObject* pyvars) {
     // set global 'dukpy' to be our input
     Py_INCREF(pyvars);
     if (dukpy_wrap_a_python_object_somehow_and_return_it(ctx, pyvars) != 1) {
         dukpy_set_python_error_from_js_error(ctx);
-        return NULL;
+        return 0;
     }
     duk_put_global_string(ctx, "dukpy");
+    return 1;
+}
 
-    int res = duk_peval_string(ctx, command);
-    if (res != 0) {
-        dukpy_set_python_error_from_js_error(ctx);
-        return NULL;
-    }
-
+static PyObject* dukpy_finish_eval(duk_context *ctx) {
+    DUKPY_STAT_TIMER_START(convStart);
     PyObject* seen = PyDict_New();
     PyObject* ret = dukpy_pyobj_from_stack(ctx, -1, seen, 0, 0);
     Py_DECREF(seen);
+    DUKPY_STAT_TIMER_STOP(ctx, conversionTime, convStart);
     duk_pop(ctx);
 
     // clean up 'dukpy' global
     duk_push_global_object(ctx);
     duk_del_prop_string(ctx, -1, "dukpy");
+    duk_pop(ctx);
+    dukpy_release_now(ctx);
 
     return ret;
 }
 
-static PyObject *DukPy_add_global_object_ctx(PyObject *self, PyObject *args) {
-    PyObject *pyctx;
-    const char *object_name;
-    PyObject *object;
+/*
+ * Records the current callstack as one "root;...;leaf" line, using
+ * Duktape.act() so that we don't need to reach into Duktape's internals.
+ * Duktape.act is a native function, so calling it from inside the executor
+ * interrupt doesn't run any bytecode.
+ */
+static void dukpy_profile_sample(struct DukPyHeap* heap) {
+    // sample whichever thread is running, it's a coroutine's while it's resumed
+    if (!duk_check_stack(heap->ctx, 1)) {
+        return;
+    }
+    duk_push_current_thread(heap->ctx); // [... thread]
+    duk_context *ctx = duk_get_context(heap->ctx, -1);
+    duk_pop(heap->ctx); // [...], the running thread is reachable anyway
+    if (!ctx || !duk_check_stack(ctx, 8)) {
+        return;
+    }
 
-    if (!PyArg_ParseTuple(args, "OsO", &pyctx, &object_name, &object))
-        return NULL;
+    // the builtin Duktape.act saved when the heap was made, scripts may replace the global one
+    duk_push_global_stash(ctx); // [... gstash]
+    duk_get_prop_string(ctx, -1, "dukpyAct"); // [... gstash act]
+    duk_remove(ctx, -2); // [... act]
+    if (!duk_is_c_function(ctx, -1)) {
+        duk_pop(ctx);
+        return;
+    }
 
-    if (!pyctx) {
-        PyErr_SetString(PyExc_ValueError, "must provide a duk_context");
-        return NULL;
+    duk_push_string(ctx, ""); // [... act stack]
+    int depth = 0;
+    // -1 is Duktape.act itself
+    for (int level = -2; depth < DUKPY_PROFILE_MAX_DEPTH; level--) {
+        duk_dup(ctx, -2); // [... act stack act]
+        duk_push_int(ctx, level); // [... act stack act level]
+        if (duk_pcall(ctx, 1) != DUK_EXEC_SUCCESS || !duk_is_object(ctx, -1)) {
+            duk_pop(ctx); // [... act stack]
+            break;
+        }
+        // [... act stack record]
+        duk_get_prop_string(ctx, -1, "function"); // [... act stack record func]
+        duk_get_prop_string(ctx, -1, "name"); // [... act stack record func name]
+        duk_get_prop_string(ctx, -2, "fileName"); // [... act stack record func name fileName]
+        const char* name = duk_get_string(ctx, -2);
+        const char* fileName = duk_get_string(ctx, -1);
+        if (!name || !*name) {
+            name = "(anonymous)";
+        }
+
+        if (!fileName) {
+            duk_push_string(ctx, name);
+        } else if (heap->profileLines) {
+            duk_get_prop_string(ctx, -4, "lineNumber");
+            long line = (long)duk_get_number(ctx, -1);
+            duk_pop(ctx);
+            duk_push_sprintf(ctx, "%s (%s:%ld)", name, fileName, line);
+        } else {
+            duk_push_sprintf(ctx, "%s (%s)", name, fileName);
+        }
+        // [... act stack record func name fileName frame]
+        duk_replace(ctx, -5); // [... act stack frame func name fileName]
+        duk_pop_3(ctx); // [... act stack frame]
+
+        if (depth) {
+            duk_push_string(ctx, ";"); // [... act stack frame ";"]
+            duk_dup(ctx, -3); // [... act stack frame ";" stack]
+            duk_concat(ctx, 3); // [... act stack newstack]
+        }
+        duk_replace(ctx, -2); // [... act newstack]
+        depth++;
     }
 
-    duk_context *ctx = dukpy_ensure_valid_ctx(pyctx);
+    if (depth) {
+        duk_size_t len;
+        const char* stack = duk_get_lstring(ctx, -1, &len);
+        PyObject* key = PyUnicode_DecodeUTF8(stack, len, "replace");
+        PyObject* count = key ? PyDict_GetItem(heap->profileSamples, key) : NULL;
+        PyObject* newCount = PyLong_FromLong(count ? PyLong_AsLong(count) + 1 : 1);
+        if (!key || !newCount || PyDict_SetItem(heap->profileSamples, key, newCount) < 0) {
+            PyErr_Clear();
+        }
+        Py_XDECREF(key);
+        Py_XDECREF(newCount);
+    }
+    duk_pop_2(ctx); // [...]
+}
+
+/*
+ * Called by Duktape every DUK_HTHREAD_INTCTR_DEFAULT bytecode instructions
+ * (see the DUK_OPT_EXEC_TIMEOUT_CHECK define in setup.py). Once this returns
+ * true Duktape throws a RangeError, and it must keep returning true until
+ * that error has unwound out of the outermost protected call, which is
+ * where dukpy_leave_protected clears the interrupt state again.
+ */
+int dukpy_exec_timeout_check(void *udata) {
+    struct DukPyHeap* heap = (struct DukPyHeap*)udata;
+    if (!heap || !heap->protectedDepth) {
+        return 0;
+    }
+    if (heap->abortReason != DUKPY_ABORT_NONE) {
+        return 1;
+    }
+
+    if (heap->profileSamples && --heap->profileCountdown <= 0) {
+        heap->profileCountdown = heap->profileEvery;
+        dukpy_profile_sample(heap);
+    }
+
+    // give other threads a chance to run, so that they can call interrupt()
+    Py_BEGIN_ALLOW_THREADS
+    Py_END_ALLOW_THREADS
+
+    if (heap->interruptRequested) {
+        heap->abortReason = DUKPY_ABORT_INTERRUPTED;
+    } else if (heap->deadline > 0 && dukpy_now() >= heap->deadline) {
+        heap->abortReason = DUKPY_ABORT_TIMEOUT;
+    } else if (heap->cpuDeadline > 0 && dukpy_cpu_now() >= heap->cpuDeadline) {
+        heap->abortReason = DUKPY_ABORT_CPU_TIMEOUT;
+    } else if (PyErr_CheckSignals() < 0) {
+        // e.g. KeyboardInterrupt, stash it until we're back in Python
+        PyErr_Fetch(&heap->abortType, &heap->abortValue, &heap->abortTraceback);
+        heap->abortReason = DUKPY_ABORT_PYERR;
+    }
+    return heap->abortReason != DUKPY_ABORT_NONE;
+}
+
+static struct DukPyHeap* dukpy_enter_protected(duk_context *ctx) {
+    struct DukPyHeap* heap = dukpy_get_heap(ctx);
+    if (!heap->protectedDepth) {
+        heap->abortReason = DUKPY_ABORT_NONE;
+        Py_CLEAR(heap->abortType);
+        Py_CLEAR(heap->abortValue);
+        Py_CLEAR(heap->abortTraceback);
+#ifdef DUKPY_STATS
+        heap->evalStart = dukpy_now();
+#endif
+        heap->limitExceeded = 0;
+        heap->owner = (unsigned long)PyThread_get_thread_ident();
+    }
+    heap->protectedDepth++;
+    return heap;
+}
+
+static void dukpy_leave_protected(struct DukPyHeap* heap) {
+    heap->protectedDepth--;
+    if (!heap->protectedDepth) {
+        dukpy_delete_orphan_handles(heap);
+        dukpy_drain_releases(heap);
+        // the abort reason is left for dukpy_set_python_error_from_js_error
+        heap->interruptRequested = 0;
+#ifdef DUKPY_STATS
+        heap->stats.evalTime += dukpy_now() - heap->evalStart;
+#endif
+    }
+}
+
+static int dukpy_eval_lstring(duk_context *ctx, const char* data, duk_size_t len, const char* filename) {
+    duk_push_string(ctx, filename); // [... filename]
+
+    struct DukPyHeap* heap = dukpy_enter_protected(ctx);
+    int res = duk_eval_raw(ctx, data, len, DUK_COMPILE_EVAL | DUK_COMPILE_SAFE | DUK_COMPILE_NOSOURCE); // [... result]
+    dukpy_leave_protected(heap);
+    return res;
+}
+
+static int dukpy_pcall_method(duk_context *ctx, int nargs) {
+    struct DukPyHeap* heap = dukpy_enter_protected(ctx);
+    int res = duk_pcall_method(ctx, nargs);
+    dukpy_leave_protected(heap);
+    return res;
+}
+
+static PyObject *DukPy_eval_string_ctx(PyObject *self, PyObject *args) {
+    PyObject *pyctx;
+    const char *command;
+    PyObject *pyvars;
+
+    if (!PyArg_ParseTuple(args, "OsO", &pyctx, &command, &pyvars))
+        return NULL;
+
+    duk_context *ctx = dukpy_claim_ctx(pyctx);
     if (!ctx) {
-        PyErr_SetString(PyExc_ValueError, "must provide a duk_context");
         return NULL;
     }
 
-    if (!object) {
-        PyErr_SetString(PyExc_ValueError, "must provide valid object");
+    dukpy_maybe_gc(ctx);
+
+    if (!dukpy_push_eval_vars(ctx, pyvars)) {
         return NULL;
     }
-    Py_INCREF(object);
 
-    if (dukpy_wrap_a_python_object_somehow_and_return_it(ctx, object) != 1) {
+    int res = dukpy_eval_lstring(ctx, command, strlen(command), "input");
+    if (res != 0) {
         dukpy_set_python_error_from_js_error(ctx);
         return NULL;
     }
-    duk_put_global_string(ctx, object_name); // []
 
-    Py_RETURN_NONE;
+    return dukpy_finish_eval(ctx);
 }
 
-static PyObject *DukPy_exec_dpf(PyObject *self, PyObject *args) {
-    PyObject *pydpf;
-    PyObject *pyarglist;
+static PyObject *DukPy_eval_chunks_ctx(PyObject *self, PyObject *args) {
+    PyObject *pyctx;
+    PyObject *pychunks;
+    PyObject *pyvars;
+    int separate = 0;
 
-    if (!PyArg_ParseTuple(args, "OO", &pydpf, &pyarglist))
+    if (!PyArg_ParseTuple(args, "OOO|i", &pyctx, &pychunks, &pyvars, &separate))
         return NULL;
 
-    if (!pydpf) {
-        PyErr_SetString(PyExc_ValueError, "must provide a PyDukFunction");
+    duk_context *ctx = dukpy_claim_ctx(pyctx);
+    if (!ctx) {
         return NULL;
     }
 
-    if (!PyCapsule_CheckExact(pydpf)) {
-        PyErr_SetString(PyExc_ValueError, "must provide a PyDukFunction");
+    PyObject* chunklist = PySequence_Fast(pychunks, "must provide a sequence of chunks");
+    if (!chunklist) {
         return NULL;
     }
 
-    struct DukPyFunction* dpf = (struct DukPyFunction*)PyCapsule_GetPointer(pydpf, DUKPY_FUNCTION_CAPSULE_NAME);
-    if (!dpf) {
-        PyErr_SetString(PyExc_ValueError, "must provide a PyDukFunction");
-        return NULL;
+    Py_ssize_t nchunks = PySequence_Fast_GET_SIZE(chunklist);
+    struct DukPyChunk* chunks = PyMem_Malloc(sizeof(struct DukPyChunk) * (nchunks ? nchunks : 1));
+    if (!chunks) {
+        Py_DECREF(chunklist);
+        return PyErr_NoMemory();
     }
 
-    if (!pyarglist || !PySequence_Check(pyarglist)) {
-        PyErr_SetString(PyExc_ValueError, "must provide an arglist");
-        return NULL;
+    PyObject* ret = NULL;
+    Py_ssize_t nready = 0;
+    for (; nready < nchunks; nready++) {
+        PyObject* item = PySequence_Fast_GET_ITEM(chunklist, nready);
+        if (!separate && PyTuple_Check(item)) {
+            // one compilation unit can't have several filenames
+            PyErr_SetString(PyExc_TypeError, "(filename, code) chunks need separate compilation units, use evaljs_units");
+            goto cleanup;
+        }
+        if (!dukpy_chunk_from_pyobj(&chunks[nready], item)) {
+            dukpy_chunk_release(&chunks[nready]);
+            goto cleanup;
+        }
     }
 
-    duk_push_global_stash(dpf->ctx); // [... gstash]
-    duk_get_prop_string(dpf->ctx, -1, dpf->name); // [... gstash func]
-    duk_get_prop_string(dpf->ctx, -1, DUKPY_INTERNAL_PROPERTY "_this"); // [... gstash func this]
+    dukpy_maybe_gc(ctx);
 
-    int argCount = dukpy_push_a_python_sequence_somehow_and_return_the_count(dpf->ctx, pyarglist);
+    if (!dukpy_push_eval_vars(ctx, pyvars)) {
+        goto cleanup;
+    }
 
-    int result = duk_pcall_method(dpf->ctx, argCount); // [... gstash res <args>]
-    if (result) {
-        dukpy_set_python_error_from_js_error(dpf->ctx);
-        return NULL;
+    int res = 0;
+    if (separate) {
+        // every chunk is its own compilation unit, the last one's value wins
+        duk_push_undefined(ctx); // [undefined]
+        for (Py_ssize_t i = 0; i < nchunks && res == 0; i++) {
+            duk_pop(ctx); // []
+            res = dukpy_eval_lstring(ctx, chunks[i].data, chunks[i].len, chunks[i].filename); // [result]
+        }
+    } else {
+        // glue everything together on the C side, the same way evaljs
+        // used to do it with ';\n'.join(), but without the Python string.
+        // Duktape compiles from a single buffer, so this is still one copy
+        // of the whole input; evaljs_units compiles chunks where they are.
+        static const char separator[] = ";\n";
+        size_t seplen = sizeof(separator) - 1;
+        size_t total = 0;
+        for (Py_ssize_t i = 0; i < nchunks; i++) {
+            total += chunks[i].len + (i ? seplen : 0);
+        }
+
+        char* joined = PyMem_Malloc(total ? total : 1);
+        if (!joined) {
+            PyErr_NoMemory();
+            goto cleanup;
+        }
+
+        char* walk = joined;
+        for (Py_ssize_t i = 0; i < nchunks; i++) {
+            if (i) {
+                memcpy(walk, separator, seplen);
+                walk += seplen;
+            }
+            memcpy(walk, chunks[i].data, chunks[i].len);
+            walk += chunks[i].len;
+        }
+
+        res = dukpy_eval_lstring(ctx, joined, total, "input"); // [result]
+        PyMem_Free(joined);
     }
-    PyObject* seen = PyDict_New();
-    PyObject* ret = dukpy_pyobj_from_stack(dpf->ctx, -1, seen, 0, 0);
-    Py_DECREF(seen);
-    duk_pop_2(dpf->ctx); // [...]
 
+    if (res != 0) {
+        dukpy_set_python_error_from_js_error(ctx);
+        goto cleanup;
+    }
+
+    ret = dukpy_finish_eval(ctx);
+
+cleanup:
+    for (Py_ssize_t i = 0; i < nready; i++) {
+        dukpy_chunk_release(&chunks[i]);
+    }
+    PyMem_Free(chunks);
+    Py_DECREF(chunklist);
     return ret;
 }
 
-static PyObject *DukPy_get_item_dpf(PyObject *self, PyObject *args) {
-    PyObject *pydpf;
-    PyObject *pykey;
+static PyObject *DukPy_eval_file_ctx(PyObject *self, PyObject *args) {
+    PyObject *pyctx;
+    const char *path;
+    PyObject *pyvars;
 
-    if (!PyArg_ParseTuple(args, "OO", &pydpf, &pykey))
+    if (!PyArg_ParseTuple(args, "OsO", &pyctx, &path, &pyvars))
         return NULL;
 
-    if (!pydpf) {
-        PyErr_SetString(PyExc_ValueError, "must provide a PyDukFunction");
+    duk_context *ctx = dukpy_claim_ctx(pyctx);
+    if (!ctx) {
         return NULL;
     }
 
-    if (!PyCapsule_CheckExact(pydpf)) {
-        PyErr_SetString(PyExc_ValueError, "must provide a PyDukFunction");
+    struct DukPyMappedFile mf;
+    if (!dukpy_map_file(&mf, path)) {
         return NULL;
     }
 
-    struct DukPyFunction* dpf = (struct DukPyFunction*)PyCapsule_GetPointer(pydpf, DUKPY_FUNCTION_CAPSULE_NAME);
-    if (!dpf) {
-        PyErr_SetString(PyExc_ValueError, "must provide a PyDukFunction");
+    dukpy_maybe_gc(ctx);
+
+    if (!dukpy_push_eval_vars(ctx, pyvars)) {
+        dukpy_unmap_file(&mf);
         return NULL;
     }
 
-    if (!pykey || !DUKPY_IS_NSTRING(pykey)) {
-        PyErr_SetString(PyExc_ValueError, "must provide a key");
+    // the mapping goes straight to the lexer, and the path is what stack traces show
+    int res = dukpy_eval_lstring(ctx, mf.data, mf.len, path);
+    dukpy_unmap_file(&mf);
+    if (res != 0) {
+        dukpy_set_python_error_from_js_error(ctx);
         return NULL;
     }
 
-    const char* keycesu8 = dukpy_nstring_to_char(pykey);
-    if (!keycesu8) {
-        PyErr_SetString(PyExc_RuntimeError, "unable to convert string to CESU8");
+    return dukpy_finish_eval(ctx);
+}
+
+static PyObject *DukPy_load_file(PyObject *self, PyObject *args) {
+    const char *path;
+
+    if (!PyArg_ParseTuple(args, "s", &path))
+        return NULL;
+
+    struct DukPyMappedFile mf;
+    if (!dukpy_map_file(&mf, path)) {
         return NULL;
     }
 
-    duk_push_global_stash(dpf->ctx); // [... gstash]
-    duk_get_prop_string(dpf->ctx, -1, dpf->name); // [... gstash func]
-    duk_get_prop_string(dpf->ctx, -1, keycesu8); // [... gstash func prop]
+    // decode straight out of the mapping rather than through a read() buffer
+#if PY_MAJOR_VERSION >= 3
+    PyObject* ret = PyUnicode_DecodeUTF8(mf.data, mf.len, NULL);
+#else
+    PyObject* ret = PyString_FromStringAndSize(mf.data, mf.len);
+#endif
+    dukpy_unmap_file(&mf);
+    return ret;
+}
+
+static duk_ret_t dukpy_dump_function_unsafe(duk_context *ctx) {
+    duk_dup_top(ctx); // [func func]
+    duk_dump_function(ctx); // [func bytecode]
+    return 2;
+}
+
+static duk_ret_t dukpy_load_function_unsafe(duk_context *ctx) {
+    duk_load_function(ctx); // [func]
+    return 1;
+}
+
+/*
+ * Compiles prefix + data + suffix into a function and returns it along
+ * with its bytecode, so module wrappers never have to be glued together
+ * as Python strings.
+ */
+static PyObject* dukpy_compile_wrapped(duk_context *ctx, const char* filename, const char* prefix, const char* data, size_t len, const char* suffix) {
+    size_t prefixlen = strlen(prefix);
+    size_t suffixlen = strlen(suffix);
+    size_t total = prefixlen + len + suffixlen;
+    char* source = PyMem_Malloc(total ? total : 1);
+    if (!source) {
+        return PyErr_NoMemory();
+    }
+    memcpy(source, prefix, prefixlen);
+    memcpy(source + prefixlen, data, len);
+    memcpy(source + prefixlen + len, suffix, suffixlen);
+
+    duk_push_string(ctx, filename); // [... filename]
+    int res = duk_pcompile_lstring_filename(ctx, DUK_COMPILE_FUNCTION | DUK_COMPILE_NOSOURCE, source, total); // [... func]
+    PyMem_Free(source);
+    if (res == 0) {
+        res = duk_safe_call(ctx, dukpy_dump_function_unsafe, 1, 2); // [... func bytecode]
+    }
+    if (res != 0) {
+        dukpy_set_python_error_from_js_error(ctx); // [...]
+        return NULL;
+    }
+
+    duk_size_t size = 0;
+    void* buf = duk_get_buffer(ctx, -1, &size);
+    PyObject* bytecode = PyBytes_FromStringAndSize((const char*)buf, size);
+    duk_pop(ctx); // [... func]
 
     PyObject* seen = PyDict_New();
-    PyObject* ret = dukpy_pyobj_from_stack(dpf->ctx, -1, seen, 1, -2);
+    PyObject* func = dukpy_pyobj_from_stack(ctx, -1, seen, 0, 0);
     Py_DECREF(seen);
-    duk_pop_3(dpf->ctx); // [...]
+    duk_pop(ctx); // [...]
 
-    return ret;
+    return Py_BuildValue("(NN)", func, bytecode);
 }
 
-static PyObject *DukPy_set_item_dpf(PyObject *self, PyObject *args) {
-    PyObject *pydpf;
-    PyObject *pykey;
-    PyObject *pyvalue;
+static PyObject *DukPy_compile_file_ctx(PyObject *self, PyObject *args) {
+    PyObject *pyctx;
+    const char *path;
+    const char *prefix;
+    const char *suffix;
 
-    if (!PyArg_ParseTuple(args, "OOO", &pydpf, &pykey, &pyvalue))
+    if (!PyArg_ParseTuple(args, "Osss", &pyctx, &path, &prefix, &suffix))
         return NULL;
 
-    if (!pydpf) {
-        PyErr_SetString(PyExc_ValueError, "must provide a PyDukFunction");
+    duk_context *ctx = dukpy_claim_ctx(pyctx);
+    if (!ctx) {
         return NULL;
     }
 
-    if (!PyCapsule_CheckExact(pydpf)) {
-        PyErr_SetString(PyExc_ValueError, "must provide a PyDukFunction");
+    struct DukPyMappedFile mf;
+    if (!dukpy_map_file(&mf, path)) {
         return NULL;
     }
 
-    struct DukPyFunction* dpf = (struct DukPyFunction*)PyCapsule_GetPointer(pydpf, DUKPY_FUNCTION_CAPSULE_NAME);
+    PyObject* ret = dukpy_compile_wrapped(ctx, path, prefix, mf.data, mf.len, suffix);
+    dukpy_unmap_file(&mf);
+    return ret;
+}
+
+static PyObject *DukPy_compile_source_ctx(PyObject *self, PyObject *args) {
+    PyObject *pyctx;
+    PyObject *pysource;
+    const char *filename;
+    const char *prefix;
+    const char *suffix;
+    char *source;
+    Py_ssize_t len;
+
+    if (!PyArg_ParseTuple(args, "OOsss", &pyctx, &pysource, &filename, &prefix, &suffix))
+        return NULL;
+
+    if (PyBytes_AsStringAndSize(pysource, &source, &len) != 0)
+        return NULL;
+
+    duk_context *ctx = dukpy_claim_ctx(pyctx);
+    if (!ctx) {
+        return NULL;
+    }
+
+    return dukpy_compile_wrapped(ctx, filename, prefix, source, len, suffix);
+}
+
+static PyObject *DukPy_load_function_ctx(PyObject *self, PyObject *args) {
+    PyObject *pyctx;
+    PyObject *pybytecode;
+    char *bytecode;
+    Py_ssize_t len;
+
+    if (!PyArg_ParseTuple(args, "OO", &pyctx, &pybytecode))
+        return NULL;
+
+    if (PyBytes_AsStringAndSize(pybytecode, &bytecode, &len) != 0)
+        return NULL;
+
+    duk_context *ctx = dukpy_claim_ctx(pyctx);
+    if (!ctx) {
+        return NULL;
+    }
+
+    // bytecode isn't validated by Duktape, callers must only pass what
+    // ctx_compile_file produced with this very build
+    void* buf = duk_push_fixed_buffer(ctx, len); // [... bytecode]
+    memcpy(buf, bytecode, len);
+    if (duk_safe_call(ctx, dukpy_load_function_unsafe, 1, 1) != 0) { // [... func]
+        dukpy_set_python_error_from_js_error(ctx); // [...]
+        return NULL;
+    }
+
+    PyObject* seen = PyDict_New();
+    PyObject* func = dukpy_pyobj_from_stack(ctx, -1, seen, 0, 0);
+    Py_DECREF(seen);
+    duk_pop(ctx); // [...]
+    return func;
+}
+
+/*
+ * Compiles prefix + source + suffix to bytecode on a private, throwaway
+ * heap with the GIL released, so several modules can be compiled by
+ * worker threads at once. The heap uses Duktape's default allocator and
+ * fatal handler because neither may touch Python here. Returns None when
+ * the source doesn't compile; requiring the module reports the error.
+ */
+static PyObject *DukPy_compile_bytecode(PyObject *self, PyObject *args) {
+    PyObject *pysource;
+    const char *filename;
+    const char *prefix;
+    const char *suffix;
+    char *source;
+    Py_ssize_t len;
+
+    if (!PyArg_ParseTuple(args, "Osss", &pysource, &filename, &prefix, &suffix))
+        return NULL;
+
+    if (PyBytes_AsStringAndSize(pysource, &source, &len) != 0)
+        return NULL;
+
+    size_t prefixlen = strlen(prefix);
+    size_t suffixlen = strlen(suffix);
+    size_t total = prefixlen + len + suffixlen;
+    char* code = malloc(total ? total : 1);
+    if (!code) {
+        return PyErr_NoMemory();
+    }
+    memcpy(code, prefix, prefixlen);
+    memcpy(code + prefixlen, source, len);
+    memcpy(code + prefixlen + len, suffix, suffixlen);
+
+    char* bytecode = NULL;
+    duk_size_t size = 0;
+    int created = 0;
+
+    Py_BEGIN_ALLOW_THREADS
+    duk_context *ctx = duk_create_heap(NULL, NULL, NULL, NULL, NULL);
+    if (ctx) {
+        created = 1;
+        duk_push_string(ctx, filename); // [filename]
+        if (duk_pcompile_lstring_filename(ctx, DUK_COMPILE_FUNCTION | DUK_COMPILE_NOSOURCE, code, total) == 0 &&
+                duk_safe_call(ctx, dukpy_dump_function_unsafe, 1, 2) == 0) { // [func bytecode]
+            void* buf = duk_get_buffer(ctx, -1, &size);
+            bytecode = malloc(size ? size : 1);
+            if (bytecode) {
+                memcpy(bytecode, buf, size);
+            }
+        }
+        duk_destroy_heap(ctx);
+    }
+    free(code);
+    Py_END_ALLOW_THREADS
+
+    if (!created) {
+        PyErr_SetString(PyExc_RuntimeError, "allocating duk_context");
+        return NULL;
+    }
+    if (!bytecode) {
+        Py_RETURN_NONE;
+    }
+    PyObject* ret = PyBytes_FromStringAndSize(bytecode, size);
+    free(bytecode);
+    return ret;
+}
+
+static duk_ret_t dukpy_module_require(duk_context *ctx);
+
+static void dukpy_push_module_require(duk_context *ctx, const char* base, size_t baselen) {
+    duk_push_c_function(ctx, dukpy_module_require, 1); // [... require]
+    if (base) {
+        duk_push_lstring(ctx, base, baselen); // [... require base]
+        duk_put_prop_string(ctx, -2, DUKPY_INTERNAL_PROPERTY "_base"); // [... require]
+    }
+}
+
+/*
+ * require() for RequirableContext. Every module gets its own copy, which
+ * knows the directory the module was found in, so relative ids resolve
+ * without any global state. Modules are kept in the stash by resolved
+ * path, along with what each (directory, id) pair resolved to, so only
+ * the first require of a module calls the Python loader:
+ *
+ *     loader(pyctx, directory or None, id) -> (path, function, exports)
+ *
+ * where function is the compiled module function, or None when exports
+ * is what the module exports.
+ */
+static void dukpy_module_forget(duk_context *ctx) {
+    // stack: [id require base gstash modules resolved key path ...]
+    duk_dup(ctx, 7);
+    duk_del_prop(ctx, 4); // delete modules[path]
+    duk_dup(ctx, 6);
+    duk_del_prop(ctx, 5); // delete resolved[key]
+}
+
+static duk_ret_t dukpy_module_require(duk_context *ctx) {
+    // arguments: [id]
+    duk_require_string(ctx, 0);
+    duk_push_current_function(ctx); // [id require]
+    duk_get_prop_string(ctx, 1, DUKPY_INTERNAL_PROPERTY "_base"); // [id require base]
+    const char* base = duk_get_string(ctx, 2);
+
+    duk_push_global_stash(ctx); // [id require base gstash]
+    duk_get_prop_string(ctx, 3, "dukpyModules"); // [id require base gstash modules]
+    duk_get_prop_string(ctx, 3, "dukpyResolved"); // [id require base gstash modules resolved]
+    duk_push_string(ctx, base ? base : "");
+    duk_push_lstring(ctx, "\0", 1);
+    duk_dup(ctx, 0);
+    duk_concat(ctx, 3); // [id require base gstash modules resolved key]
+
+    duk_dup(ctx, 6);
+    if (duk_get_prop(ctx, 5)) { // [... key path]
+        if (duk_get_prop(ctx, 4)) { // [... key module]
+            duk_get_prop_string(ctx, -1, "exports");
+            return 1;
+        }
+    }
+    duk_pop(ctx); // [... key]
+
+    struct DukPyHeap* heap = dukpy_get_heap(ctx);
+    if (!heap->moduleLoader) {
+        return DUK_RET_REFERENCE_ERROR;
+    }
+
+    DUKPY_STAT_INC(ctx, pyCalls);
+    DUKPY_STAT_TIMER_START(callStart);
+    PyObject* res = PyObject_CallFunction(heap->moduleLoader, "Ozs", heap->pyctx, base, duk_get_string(ctx, 0));
+    DUKPY_STAT_TIMER_STOP(ctx, callbackTime, callStart);
+    PyObject* pypath = NULL;
+    PyObject* func = NULL;
+    PyObject* exports = NULL;
+    if (res && (!PyArg_ParseTuple(res, "OOO", &pypath, &func, &exports) || !DUKPY_IS_NSTRING(pypath))) {
+        if (!PyErr_Occurred()) {
+            PyErr_SetString(PyExc_TypeError, "module loader must return (path, function, exports)");
+        }
+        Py_CLEAR(res);
+    }
+    const char* path = res ? dukpy_nstring_to_char(pypath) : NULL;
+    if (!path) {
+        Py_XDECREF(res);
+        dukpy_push_current_python_error(ctx);
+        duk_throw(ctx);
+        return DUK_RET_INTERNAL_ERROR; // just in case?
+    }
+
+    duk_push_string(ctx, path); // [... key path]
+    duk_dup(ctx, 6);
+    duk_dup(ctx, 7);
+    duk_put_prop(ctx, 5); // resolved[key] = path
+
+    // another id may have got here first, or we're in a require cycle
+    duk_dup(ctx, 7);
+    if (duk_get_prop(ctx, 4)) { // [... key path module]
+        Py_DECREF(res);
+        duk_get_prop_string(ctx, -1, "exports");
+        return 1;
+    }
+    duk_pop(ctx); // [... key path]
+
+    duk_push_object(ctx); // [... key path module]
+    duk_push_object(ctx);
+    duk_put_prop_string(ctx, 8, "exports");
+    duk_dup(ctx, 7);
+    duk_put_prop_string(ctx, 8, "id");
+    duk_dup(ctx, 7);
+    duk_dup(ctx, 8);
+    duk_put_prop(ctx, 4); // modules[path] = module
+
+    if (func == Py_None) {
+        Py_INCREF(exports);
+        if (dukpy_wrap_a_python_object_somehow_and_return_it(ctx, exports) != 1) { // [... key path module exports]
+            Py_DECREF(exports);
+            Py_DECREF(res);
+            dukpy_module_forget(ctx);
+            return DUK_RET_INTERNAL_ERROR;
+        }
+        duk_put_prop_string(ctx, 8, "exports"); // [... key path module]
+        Py_DECREF(res);
+    } else {
+        if (dukpy_jswrapped_unwrap(ctx, func) != 1) { // [... key path module func]
+            Py_DECREF(res);
+            dukpy_module_forget(ctx);
+            return DUK_RET_TYPE_ERROR;
+        }
+        // like os.path.dirname: a module at the root is in "/"
+        const char* slash = strrchr(path, '/');
+        size_t baselen = slash == path ? 1 : slash ? (size_t)(slash - path) : 0;
+        duk_get_prop_string(ctx, 8, "exports"); // [... module func exports]
+        dukpy_push_module_require(ctx, slash ? path : NULL, baselen); // [... module func exports require]
+        duk_get_prop_string(ctx, 8, "exports"); // [... module func exports require exports]
+        duk_dup(ctx, 8); // [... module func exports require exports module]
+        Py_DECREF(res);
+
+        if (duk_pcall_method(ctx, 3) != 0) { // [... key path module result]
+            // forget it so the next require tries again, like node does
+            dukpy_module_forget(ctx);
+            duk_throw(ctx);
+        }
+        duk_pop(ctx); // [... key path module]
+    }
+
+    duk_get_prop_string(ctx, 8, "exports");
+    return 1;
+}
+
+/*
+ * process.env for RequirableContext: a proxy that reads variables with
+ * getenv() when they're asked for rather than copying the environment
+ * in. Assignments go to an overrides object on the handler and only
+ * shadow the environment in this context. With a whitelist, also kept on
+ * the handler, no other variables are visible.
+ */
+extern char **environ;
+
+static int dukpy_env_allowed(duk_context *ctx, duk_idx_t handler, const char* name) {
+    if ((unsigned char)name[0] == 0xff) {
+        return 0; // internal properties never come from the environment
+    }
+    if (!duk_get_prop_string(ctx, handler, "whitelist")) { // [... whitelist]
+        duk_pop(ctx);
+        return 1;
+    }
+    int allowed = duk_has_prop_string(ctx, -1, name);
+    duk_pop(ctx);
+    return allowed;
+}
+
+/*
+ * Environment values are bytes in the locale's encoding, decode them the
+ * way os.environ does. On Python 3 undecodable bytes become lone surrogates,
+ * which Duktape stores like any other code point.
+ */
+static void dukpy_push_env_value(duk_context *ctx, const char* value) {
+#if PY_MAJOR_VERSION >= 3
+    PyObject* text = PyUnicode_DecodeFSDefault(value);
+    PyObject* utf8 = text ? PyUnicode_AsEncodedString(text, "utf-8", "surrogatepass") : NULL;
+    Py_XDECREF(text);
+    if (utf8) {
+        duk_push_lstring(ctx, PyBytes_AS_STRING(utf8), PyBytes_GET_SIZE(utf8));
+        Py_DECREF(utf8);
+        return;
+    }
+    PyErr_Clear();
+#endif
+    // Python 2's os.environ holds the bytes as they are
+    duk_push_string(ctx, value);
+}
+
+static duk_ret_t dukpy_env_get(duk_context *ctx) {
+    // arguments: [target key recv]
+    duk_set_top(ctx, 2);
+    const char* name = duk_to_string(ctx, 1);
+    duk_push_this(ctx); // [target key handler]
+    duk_get_prop_string(ctx, 2, "overrides"); // [target key handler overrides]
+    duk_dup(ctx, 1);
+    duk_get_prop(ctx, 3); // [target key handler overrides override]
+    if (duk_is_string(ctx, -1)) {
+        return 1;
+    }
+    // false marks a deleted variable
+    int deleted = duk_is_boolean(ctx, -1);
+    duk_pop(ctx);
+
+    const char* value = !deleted && dukpy_env_allowed(ctx, 2, name) ? getenv(name) : NULL;
+    if (value) {
+        dukpy_push_env_value(ctx, value);
+        return 1;
+    }
+
+    // toString and friends
+    duk_dup(ctx, 1);
+    duk_get_prop(ctx, 0);
+    return 1;
+}
+
+static duk_ret_t dukpy_env_set(duk_context *ctx) {
+    // arguments: [target key value recv]
+    duk_set_top(ctx, 3);
+    duk_to_string(ctx, 1);
+    duk_to_string(ctx, 2); // like node, everything becomes a string
+    duk_push_this(ctx); // [target key value handler]
+    duk_get_prop_string(ctx, 3, "overrides"); // [target key value handler overrides]
+    duk_dup(ctx, 1);
+    duk_dup(ctx, 2);
+    duk_put_prop(ctx, 4);
+    duk_push_true(ctx);
+    return 1;
+}
+
+static duk_ret_t dukpy_env_has(duk_context *ctx) {
+    // arguments: [target key]
+    const char* name = duk_to_string(ctx, 1);
+    duk_push_this(ctx); // [target key handler]
+    duk_get_prop_string(ctx, 2, "overrides"); // [target key handler overrides]
+    duk_dup(ctx, 1);
+    duk_get_prop(ctx, 3); // [target key handler overrides override]
+    int result;
+    if (duk_is_undefined(ctx, -1)) {
+        result = dukpy_env_allowed(ctx, 2, name) && getenv(name) != NULL;
+    } else {
+        result = duk_is_string(ctx, -1);
+    }
+    duk_pop(ctx);
+    if (!result) {
+        duk_dup(ctx, 1);
+        result = duk_has_prop(ctx, 0);
+    }
+    duk_push_boolean(ctx, result);
+    return 1;
+}
+
+static duk_ret_t dukpy_env_deleteProperty(duk_context *ctx) {
+    // arguments: [target key]
+    duk_push_this(ctx); // [target key handler]
+    duk_get_prop_string(ctx, 2, "overrides"); // [target key handler overrides]
+    duk_dup(ctx, 1);
+    duk_push_false(ctx); // hides the variable from the environment too
+    duk_put_prop(ctx, 3);
+    duk_push_true(ctx);
+    return 1;
+}
+
+static duk_ret_t dukpy_env_ownKeys(duk_context *ctx) {
+    // arguments: [target]
+    duk_push_this(ctx); // [target handler]
+    duk_get_prop_string(ctx, 1, "overrides"); // [target handler overrides]
+    duk_push_object(ctx); // [target handler overrides seen]
+    duk_push_array(ctx); // [target handler overrides seen keys]
+    duk_uarridx_t count = 0;
+
+    for (char** entry = environ; entry && *entry; entry++) {
+        const char* eq = strchr(*entry, '=');
+        if (!eq || eq == *entry) {
+            continue;
+        }
+        duk_push_lstring(ctx, *entry, eq - *entry); // [... keys name]
+        // overridden and deleted variables are up to the overrides
+        if (!dukpy_env_allowed(ctx, 1, duk_get_string(ctx, -1)) ||
+                duk_has_prop_string(ctx, 2, duk_get_string(ctx, -1)) ||
+                duk_has_prop_string(ctx, 3, duk_get_string(ctx, -1))) {
+            duk_pop(ctx);
+            continue;
+        }
+        duk_dup_top(ctx);
+        duk_push_true(ctx);
+        duk_put_prop(ctx, 3); // seen[name] = true
+        duk_put_prop_index(ctx, 4, count++); // [... keys]
+    }
+
+    duk_enum(ctx, 2, DUK_ENUM_OWN_PROPERTIES_ONLY); // [... keys enum]
+    while (duk_next(ctx, -1, 1)) { // [... keys enum name value]
+        if (!duk_is_string(ctx, -1)) {
+            duk_pop_2(ctx);
+            continue;
+        }
+        duk_pop(ctx); // [... keys enum name]
+        duk_put_prop_index(ctx, 4, count++); // [... keys enum]
+    }
+    duk_pop(ctx); // [... keys]
+    return 1;
+}
+
+static PyObject *DukPy_install_process_env_ctx(PyObject *self, PyObject *args) {
+    PyObject *pyctx;
+    PyObject *whitelist;
+
+    if (!PyArg_ParseTuple(args, "OO", &pyctx, &whitelist))
+        return NULL;
+
+    duk_context *ctx = dukpy_claim_ctx(pyctx);
+    if (!ctx) {
+        return NULL;
+    }
+
+    PyObject* names = NULL;
+    if (whitelist != Py_None) {
+        names = PySequence_Fast(whitelist, "whitelist must be a sequence of names");
+        if (!names) {
+            return NULL;
+        }
+    }
+
+    duk_push_global_object(ctx); // [global]
+    if (!duk_get_prop_string(ctx, -1, "process") || !duk_is_object(ctx, -1)) { // [global process]
+        duk_pop(ctx);
+        duk_push_object(ctx);
+        duk_dup_top(ctx);
+        duk_put_prop_string(ctx, -3, "process");
+    }
+
+    duk_get_prop_string(ctx, -2, "Proxy"); // [global process Proxy]
+    duk_push_object(ctx); // [global process Proxy target]
+    duk_push_object(ctx); // [global process Proxy target handler]
+
+    duk_push_c_function(ctx, dukpy_env_get, 3);
+    duk_put_prop_string(ctx, -2, "get");
+    duk_push_c_function(ctx, dukpy_env_set, 4);
+    duk_put_prop_string(ctx, -2, "set");
+    duk_push_c_function(ctx, dukpy_env_has, 2);
+    duk_put_prop_string(ctx, -2, "has");
+    duk_push_c_function(ctx, dukpy_env_deleteProperty, 2);
+    duk_put_prop_string(ctx, -2, "deleteProperty");
+    duk_push_c_function(ctx, dukpy_env_ownKeys, 1);
+    duk_put_prop_string(ctx, -2, "enumerate");
+    duk_push_c_function(ctx, dukpy_env_ownKeys, 1);
+    duk_put_prop_string(ctx, -2, "ownKeys");
+
+    // overrides and the whitelist have no prototype, so any key they
+    // have is one that was put there
+    duk_eval_string(ctx, "Object.create(null)");
+    duk_put_prop_string(ctx, -2, "overrides");
+    if (names) {
+        duk_eval_string(ctx, "Object.create(null)"); // [... handler whitelist]
+        for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(names); i++) {
+            PyObject* name = PySequence_Fast_GET_ITEM(names, i);
+            const char* cname = DUKPY_IS_NSTRING(name) ? dukpy_nstring_to_char(name) : NULL;
+            if (!cname) {
+                Py_DECREF(names);
+                duk_pop_n(ctx, 6); // []
+                if (!PyErr_Occurred()) {
+                    PyErr_SetString(PyExc_TypeError, "whitelist must be a sequence of names");
+                }
+                return NULL;
+            }
+            duk_push_true(ctx);
+            duk_put_prop_string(ctx, -2, cname);
+        }
+        duk_put_prop_string(ctx, -2, "whitelist");
+        Py_DECREF(names);
+    }
+
+    duk_new(ctx, 2); // [global process env]
+    duk_put_prop_string(ctx, -2, "env"); // [global process]
+    duk_pop_2(ctx); // []
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *DukPy_install_require_ctx(PyObject *self, PyObject *args) {
+    PyObject *pyctx;
+    PyObject *loader;
+
+    if (!PyArg_ParseTuple(args, "OO", &pyctx, &loader))
+        return NULL;
+
+    duk_context *ctx = dukpy_claim_ctx(pyctx);
+    if (!ctx) {
+        return NULL;
+    }
+
+    if (!PyCallable_Check(loader)) {
+        PyErr_SetString(PyExc_TypeError, "module loader must be callable");
+        return NULL;
+    }
+
+    struct DukPyHeap* heap = dukpy_get_heap(ctx);
+    PyObject* old = heap->moduleLoader;
+    Py_INCREF(loader);
+    heap->moduleLoader = loader;
+    Py_XDECREF(old);
+
+    duk_push_global_stash(ctx); // [... gstash]
+    duk_push_object(ctx);
+    duk_put_prop_string(ctx, -2, "dukpyModules");
+    duk_push_object(ctx);
+    duk_put_prop_string(ctx, -2, "dukpyResolved");
+    duk_pop(ctx); // [...]
+
+    duk_push_global_object(ctx); // [... global]
+    dukpy_push_module_require(ctx, NULL, 0); // [... global require]
+    duk_put_prop_string(ctx, -2, "require"); // [... global]
+    duk_pop(ctx); // [...]
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *DukPy_set_gc_policy_ctx(PyObject *self, PyObject *args) {
+    PyObject *pyctx;
+    int policy;
+    long interval = 1;
+    Py_ssize_t threshold = 0;
+
+    if (!PyArg_ParseTuple(args, "Oi|ln", &pyctx, &policy, &interval, &threshold))
+        return NULL;
+
+    duk_context *ctx = dukpy_claim_ctx(pyctx);
+    if (!ctx) {
+        return NULL;
+    }
+
+    if (policy < DUKPY_GC_NEVER || policy > DUKPY_GC_THRESHOLD) {
+        PyErr_SetString(PyExc_ValueError, "unknown garbage collection policy");
+        return NULL;
+    }
+    if (interval < 1 || threshold < 0) {
+        PyErr_SetString(PyExc_ValueError, "garbage collection interval and threshold must be positive");
+        return NULL;
+    }
+
+    struct DukPyHeap* heap = dukpy_get_heap(ctx);
+    heap->gcPolicy = policy;
+    heap->gcInterval = interval;
+    heap->gcThreshold = threshold;
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *DukPy_gc_ctx(PyObject *self, PyObject *args) {
+    PyObject *pyctx;
+    int compact = 0;
+
+    if (!PyArg_ParseTuple(args, "O|i", &pyctx, &compact))
+        return NULL;
+
+    duk_context *ctx = dukpy_claim_ctx(pyctx);
+    if (!ctx) {
+        return NULL;
+    }
+
+    dukpy_run_gc(ctx, dukpy_get_heap(ctx), compact);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *DukPy_gc_stats_ctx(PyObject *self, PyObject *args) {
+    PyObject *pyctx;
+
+    if (!PyArg_ParseTuple(args, "O", &pyctx))
+        return NULL;
+
+    duk_context *ctx = dukpy_claim_ctx(pyctx);
+    if (!ctx) {
+        return NULL;
+    }
+
+    struct DukPyHeap* heap = dukpy_get_heap(ctx);
+    return Py_BuildValue("{s:l,s:d,s:l,s:n,s:l,s:l,s:n}",
+        "collections", heap->gcCount,
+        "time", heap->gcTime,
+        "evals_since_gc", heap->evalsSinceGC,
+        "bytes_since_gc", (Py_ssize_t)heap->bytesSinceGC,
+        "released_references", heap->releasedRefs,
+        "release_batches", heap->releaseBatches,
+        "pending_releases", (Py_ssize_t)heap->releaseCount);
+}
+
+static PyObject *DukPy_allocator_stats_ctx(PyObject *self, PyObject *args) {
+    PyObject *pyctx;
+
+    if (!PyArg_ParseTuple(args, "O", &pyctx))
+        return NULL;
+
+    duk_context *ctx = dukpy_claim_ctx(pyctx);
+    if (!ctx) {
+        return NULL;
+    }
+
+    struct DukPyHeap* heap = dukpy_get_heap(ctx);
+
+    // count what's sitting unused on the pool free lists
+    Py_ssize_t pooledFreeBytes = 0;
+    for (int i = 0; i < DUKPY_POOL_CLASSES; i++) {
+        for (union DukPyBlockHeader* block = heap->poolFree[i]; block; block = DUKPY_NEXT_FREE(block)) {
+            pooledFreeBytes += sizeof(union DukPyBlockHeader) + dukpy_pool_classes[i];
+        }
+    }
+
+    return Py_BuildValue("{s:i,s:n,s:n,s:n,s:l}",
+        "allocator", heap->allocator,
+        "reserved_bytes", (Py_ssize_t)heap->reservedBytes,
+        "used_bytes", (Py_ssize_t)heap->usedBytes,
+        "pooled_free_bytes", pooledFreeBytes,
+        "chunks", heap->chunkCount);
+}
+
+static PyObject *DukPy_set_memory_limit_ctx(PyObject *self, PyObject *args) {
+    PyObject *pyctx;
+    Py_ssize_t maxHeapBytes;
+
+    if (!PyArg_ParseTuple(args, "On", &pyctx, &maxHeapBytes))
+        return NULL;
+
+    duk_context *ctx = dukpy_claim_ctx(pyctx);
+    if (!ctx) {
+        return NULL;
+    }
+
+    if (maxHeapBytes < 0) {
+        PyErr_SetString(PyExc_ValueError, "heap limit must not be negative");
+        return NULL;
+    }
+
+    dukpy_get_heap(ctx)->maxHeapBytes = maxHeapBytes;
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *DukPy_set_deadlines_ctx(PyObject *self, PyObject *args) {
+    PyObject *pyctx;
+    double timeout;
+    double cpuTimeout;
+
+    if (!PyArg_ParseTuple(args, "Odd", &pyctx, &timeout, &cpuTimeout))
+        return NULL;
+
+    duk_context *ctx = dukpy_claim_ctx(pyctx);
+    if (!ctx) {
+        return NULL;
+    }
+
+    struct DukPyHeap* heap = dukpy_get_heap(ctx);
+    PyObject* previous = Py_BuildValue("(dd)", heap->deadline, heap->cpuDeadline);
+    if (!previous) {
+        return NULL;
+    }
+
+    // budgets only ever tighten, so a nested evaluation can't outlive its caller
+    if (timeout > 0) {
+        double deadline = dukpy_now() + timeout;
+        if (heap->deadline <= 0 || deadline < heap->deadline) {
+            heap->deadline = deadline;
+        }
+    }
+    if (cpuTimeout > 0) {
+        double cpuDeadline = dukpy_cpu_now() + cpuTimeout;
+        if (heap->cpuDeadline <= 0 || cpuDeadline < heap->cpuDeadline) {
+            heap->cpuDeadline = cpuDeadline;
+        }
+    }
+
+    return previous;
+}
+
+static PyObject *DukPy_restore_deadlines_ctx(PyObject *self, PyObject *args) {
+    PyObject *pyctx;
+    double deadline;
+    double cpuDeadline;
+
+    if (!PyArg_ParseTuple(args, "O(dd)", &pyctx, &deadline, &cpuDeadline))
+        return NULL;
+
+    duk_context *ctx = dukpy_claim_ctx(pyctx);
+    if (!ctx) {
+        return NULL;
+    }
+
+    struct DukPyHeap* heap = dukpy_get_heap(ctx);
+    heap->deadline = deadline;
+    heap->cpuDeadline = cpuDeadline;
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *DukPy_interrupt_ctx(PyObject *self, PyObject *args) {
+    PyObject *pyctx;
+
+    if (!PyArg_ParseTuple(args, "O", &pyctx))
+        return NULL;
+
+    duk_context *ctx = dukpy_ensure_valid_ctx(pyctx);
+    if (!ctx) {
+        PyErr_SetString(PyExc_ValueError, "must provide a duk_context");
+        return NULL;
+    }
+
+    dukpy_get_heap(ctx)->interruptRequested = 1;
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *DukPy_profile_start_ctx(PyObject *self, PyObject *args) {
+    PyObject *pyctx;
+    long every;
+    int lines;
+
+    if (!PyArg_ParseTuple(args, "Oli", &pyctx, &every, &lines))
+        return NULL;
+
+    duk_context *ctx = dukpy_claim_ctx(pyctx);
+    if (!ctx) {
+        return NULL;
+    }
+
+    if (every < 1) {
+        PyErr_SetString(PyExc_ValueError, "sampling interval must be positive");
+        return NULL;
+    }
+
+    struct DukPyHeap* heap = dukpy_get_heap(ctx);
+    if (heap->profileSamples) {
+        PyErr_SetString(PyExc_RuntimeError, "context is already being profiled");
+        return NULL;
+    }
+
+    heap->profileSamples = PyDict_New();
+    if (!heap->profileSamples) {
+        return NULL;
+    }
+    heap->profileEvery = heap->profileCountdown = every;
+    heap->profileLines = lines;
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *DukPy_profile_stop_ctx(PyObject *self, PyObject *args) {
+    PyObject *pyctx;
+
+    if (!PyArg_ParseTuple(args, "O", &pyctx))
+        return NULL;
+
+    duk_context *ctx = dukpy_claim_ctx(pyctx);
+    if (!ctx) {
+        return NULL;
+    }
+
+    struct DukPyHeap* heap = dukpy_get_heap(ctx);
+    PyObject* samples = heap->profileSamples;
+    if (!samples) {
+        PyErr_SetString(PyExc_RuntimeError, "context is not being profiled");
+        return NULL;
+    }
+    heap->profileSamples = NULL;
+
+    // we're handing over our reference
+    return samples;
+}
+
+static PyObject *DukPy_stats_ctx(PyObject *self, PyObject *args) {
+    PyObject *pyctx;
+
+    if (!PyArg_ParseTuple(args, "O", &pyctx))
+        return NULL;
+
+    duk_context *ctx = dukpy_claim_ctx(pyctx);
+    if (!ctx) {
+        return NULL;
+    }
+
+#ifdef DUKPY_STATS
+    struct DukPyStats* st = &dukpy_get_heap(ctx)->stats;
+    return Py_BuildValue(
+        "{s:l,s:{s:l,s:l,s:l,s:l,s:l},s:l,s:l,"
+        "s:{s:l,s:l,s:l,s:l,s:l,s:l,s:l,s:l},"
+        "s:{s:l,s:l,s:l,s:l,s:l,s:l,s:l},"
+        "s:n,s:n,s:d,s:d,s:d}",
+        "python_calls", st->pyCalls,
+        "proxy_traps",
+            "get", st->trapGet, "set", st->trapSet, "has", st->trapHas,
+            "deleteProperty", st->trapDelete, "enumerate", st->trapEnumerate,
+        "handles_created", st->handlesCreated,
+        "handles_released", st->handlesReleased,
+        "to_python",
+            "none", st->toPyNone, "bool", st->toPyBool, "int", st->toPyInt,
+            "float", st->toPyFloat, "str", st->toPyString, "jsobject", st->toPyJSObject,
+            "bytes", st->toPyBytes, "other", st->toPyOther,
+        "to_javascript",
+            "null", st->toJSNull, "boolean", st->toJSBool, "number", st->toJSNumber,
+            "string", st->toJSString, "function", st->toJSCallable,
+            "unwrapped", st->toJSUnwrapped, "proxy", st->toJSProxy,
+        "string_bytes_to_python", (Py_ssize_t)st->stringBytesToPy,
+        "string_bytes_to_javascript", (Py_ssize_t)st->stringBytesToJS,
+        "eval_time", st->evalTime,
+        "callback_time", st->callbackTime,
+        "conversion_time", st->conversionTime);
+#else
+    PyErr_SetString(PyExc_RuntimeError, "dukpy was built without DUKPY_STATS");
+    return NULL;
+#endif
+}
+
+static PyObject *DukPy_memory_stats_ctx(PyObject *self, PyObject *args) {
+    PyObject *pyctx;
+
+    if (!PyArg_ParseTuple(args, "O", &pyctx))
+        return NULL;
+
+    duk_context *ctx = dukpy_claim_ctx(pyctx);
+    if (!ctx) {
+        return NULL;
+    }
+
+    // handles and other bookkeeping live in the stash, count them too
+    long stashEntries = 0;
+    duk_push_global_stash(ctx); // [... gstash]
+    duk_enum(ctx, -1, DUK_ENUM_OWN_PROPERTIES_ONLY | DUK_ENUM_INCLUDE_INTERNAL); // [... gstash enum]
+    while (duk_next(ctx, -1, 0)) {
+        stashEntries++;
+        duk_pop(ctx);
+    }
+    duk_pop_2(ctx); // [...]
+
+    struct DukPyHeap* heap = dukpy_get_heap(ctx);
+    return Py_BuildValue("{s:l,s:n,s:n,s:n,s:l,s:l,s:l,s:l}",
+        "stash_entries", stashEntries,
+        "live_bytes", (Py_ssize_t)heap->liveBytes,
+        "peak_bytes", (Py_ssize_t)heap->peakBytes,
+        "max_heap_bytes", (Py_ssize_t)heap->maxHeapBytes,
+        "allocations", heap->allocCount,
+        "reallocations", heap->reallocCount,
+        "frees", heap->freeCount,
+        "failed_allocations", heap->failedAllocs);
+}
+
+static PyObject *DukPy_add_global_object_ctx(PyObject *self, PyObject *args) {
+    PyObject *pyctx;
+    const char *object_name;
+    PyObject *object;
+
+    if (!PyArg_ParseTuple(args, "OsO", &pyctx, &object_name, &object))
+        return NULL;
+
+    if (!pyctx) {
+        PyErr_SetString(PyExc_ValueError, "must provide a duk_context");
+        return NULL;
+    }
+
+    duk_context *ctx = dukpy_claim_ctx(pyctx);
+    if (!ctx) {
+        return NULL;
+    }
+
+    if (!object) {
+        PyErr_SetString(PyExc_ValueError, "must provide valid object");
+        return NULL;
+    }
+    Py_INCREF(object);
+
+    if (dukpy_wrap_a_python_object_somehow_and_return_it(ctx, object) != 1) {
+        dukpy_set_python_error_from_js_error(ctx);
+        return NULL;
+    }
+    duk_put_global_string(ctx, object_name); // []
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *DukPy_exec_dpf(PyObject *self, PyObject *args) {
+    PyObject *pydpf;
+    PyObject *pyarglist;
+
+    if (!PyArg_ParseTuple(args, "OO", &pydpf, &pyarglist))
+        return NULL;
+
+    if (!pydpf) {
+        PyErr_SetString(PyExc_ValueError, "must provide a PyDukFunction");
+        return NULL;
+    }
+
+    if (!PyCapsule_CheckExact(pydpf)) {
+        PyErr_SetString(PyExc_ValueError, "must provide a PyDukFunction");
+        return NULL;
+    }
+
+    struct DukPyFunction* dpf = (struct DukPyFunction*)PyCapsule_GetPointer(pydpf, DUKPY_FUNCTION_CAPSULE_NAME);
+    if (!dpf) {
+        PyErr_SetString(PyExc_ValueError, "must provide a PyDukFunction");
+        return NULL;
+    }
+
+    if (!dukpy_check_owner(dpf->ctx)) {
+        return NULL;
+    }
+
+    if (!pyarglist || !PySequence_Check(pyarglist)) {
+        PyErr_SetString(PyExc_ValueError, "must provide an arglist");
+        return NULL;
+    }
+
+    duk_push_global_stash(dpf->ctx); // [... gstash]
+    duk_get_prop_string(dpf->ctx, -1, dpf->name); // [... gstash func]
+    duk_get_prop_string(dpf->ctx, -1, DUKPY_INTERNAL_PROPERTY "_this"); // [... gstash func this]
+
+    int argCount = dukpy_push_a_python_sequence_somehow_and_return_the_count(dpf->ctx, pyarglist);
+
+    int result = dukpy_pcall_method(dpf->ctx, argCount); // [... gstash res <args>]
+    if (result) {
+        duk_remove(dpf->ctx, -2); // [... err]
+        dukpy_set_python_error_from_js_error(dpf->ctx); // [...]
+        return NULL;
+    }
+    DUKPY_STAT_TIMER_START(convStart);
+    PyObject* seen = PyDict_New();
+    PyObject* ret = dukpy_pyobj_from_stack(dpf->ctx, -1, seen, 0, 0);
+    Py_DECREF(seen);
+    DUKPY_STAT_TIMER_STOP(dpf->ctx, conversionTime, convStart);
+    duk_pop_2(dpf->ctx); // [...]
+    dukpy_release_now(dpf->ctx);
+
+    return ret;
+}
+
+static PyObject *DukPy_map_dpf(PyObject *self, PyObject *args) {
+    PyObject *pydpf;
+    PyObject *pyiterable;
+    int star;
+
+    if (!PyArg_ParseTuple(args, "OOi", &pydpf, &pyiterable, &star))
+        return NULL;
+
+    if (!PyCapsule_CheckExact(pydpf)) {
+        PyErr_SetString(PyExc_ValueError, "must provide a PyDukFunction");
+        return NULL;
+    }
+
+    struct DukPyFunction* dpf = (struct DukPyFunction*)PyCapsule_GetPointer(pydpf, DUKPY_FUNCTION_CAPSULE_NAME);
+    if (!dpf) {
+        PyErr_SetString(PyExc_ValueError, "must provide a PyDukFunction");
+        return NULL;
+    }
+
+    if (!dukpy_check_owner(dpf->ctx)) {
+        return NULL;
+    }
+
+    PyObject* iter = PyObject_GetIter(pyiterable);
+    if (!iter) {
+        return NULL;
+    }
+
+    PyObject* results = PyList_New(0);
+    PyObject* seen = PyDict_New();
+    if (!results || !seen) {
+        goto error;
+    }
+
+    duk_context *ctx = dpf->ctx;
+    duk_idx_t top = duk_get_top(ctx);
+
+    // look the function up once for the whole batch
+    duk_push_global_stash(ctx); // [... gstash]
+    duk_get_prop_string(ctx, -1, dpf->name); // [... gstash func]
+    duk_get_prop_string(ctx, -1, DUKPY_INTERNAL_PROPERTY "_this"); // [... gstash func this]
+
+    PyObject* item;
+    while ((item = PyIter_Next(iter))) {
+        duk_dup(ctx, -2); // [... gstash func this func]
+        duk_dup(ctx, -2); // [... gstash func this func this]
+
+        int argCount;
+        if (star) {
+            argCount = dukpy_push_a_python_sequence_somehow_and_return_the_count(ctx, item);
+            if (argCount < 0) {
+                PyErr_SetString(PyExc_TypeError, "starmap needs a sequence of arguments for every call");
+            }
+            Py_DECREF(item);
+        } else {
+            // the wrapping takes over our reference
+            argCount = dukpy_wrap_a_python_object_somehow_and_return_it(ctx, item);
+            if (argCount != 1) {
+                Py_DECREF(item);
+                dukpy_set_python_error_from_js_error(ctx);
+            }
+        }
+        if (PyErr_Occurred()) {
+            duk_set_top(ctx, top);
+            goto error;
+        }
+
+        if (dukpy_pcall_method(ctx, argCount)) { // [... gstash func this result]
+            dukpy_set_python_error_from_js_error(ctx); // [... gstash func this]
+            duk_set_top(ctx, top);
+            goto error;
+        }
+
+        DUKPY_STAT_TIMER_START(convStart);
+        PyObject* ret = dukpy_pyobj_from_stack(ctx, -1, seen, 0, 0);
+        DUKPY_STAT_TIMER_STOP(ctx, conversionTime, convStart);
+        duk_pop(ctx); // [... gstash func this]
+        PyDict_Clear(seen);
+
+        if (!ret || PyList_Append(results, ret) < 0) {
+            Py_XDECREF(ret);
+            duk_set_top(ctx, top);
+            goto error;
+        }
+        Py_DECREF(ret);
+    }
+    duk_set_top(ctx, top); // [...]
+    dukpy_release_now(ctx);
+
+    if (PyErr_Occurred()) {
+        goto error;
+    }
+
+    Py_DECREF(seen);
+    Py_DECREF(iter);
+    return results;
+
+error:
+    if (dpf) {
+        dukpy_release_now(dpf->ctx);
+    }
+    Py_XDECREF(seen);
+    Py_XDECREF(results);
+    Py_DECREF(iter);
+    return NULL;
+}
+
+static PyObject *DukPy_get_item_dpf(PyObject *self, PyObject *args) {
+    PyObject *pydpf;
+    PyObject *pykey;
+
+    if (!PyArg_ParseTuple(args, "OO", &pydpf, &pykey))
+        return NULL;
+
+    if (!pydpf) {
+        PyErr_SetString(PyExc_ValueError, "must provide a PyDukFunction");
+        return NULL;
+    }
+
+    if (!PyCapsule_CheckExact(pydpf)) {
+        PyErr_SetString(PyExc_ValueError, "must provide a PyDukFunction");
+        return NULL;
+    }
+
+    struct DukPyFunction* dpf = (struct DukPyFunction*)PyCapsule_GetPointer(pydpf, DUKPY_FUNCTION_CAPSULE_NAME);
+    if (!dpf) {
+        PyErr_SetString(PyExc_ValueError, "must provide a PyDukFunction");
+        return NULL;
+    }
+
+    if (!dukpy_check_owner(dpf->ctx)) {
+        return NULL;
+    }
+
+    if (!pykey || !DUKPY_IS_NSTRING(pykey)) {
+        PyErr_SetString(PyExc_ValueError, "must provide a key");
+        return NULL;
+    }
+
+    const char* keycesu8 = dukpy_nstring_to_char(pykey);
+    if (!keycesu8) {
+        PyErr_SetString(PyExc_RuntimeError, "unable to convert string to CESU8");
+        return NULL;
+    }
+
+    duk_push_global_stash(dpf->ctx); // [... gstash]
+    duk_get_prop_string(dpf->ctx, -1, dpf->name); // [... gstash func]
+    duk_get_prop_string(dpf->ctx, -1, keycesu8); // [... gstash func prop]
+
+    DUKPY_STAT_TIMER_START(convStart);
+    PyObject* seen = PyDict_New();
+    PyObject* ret = dukpy_pyobj_from_stack(dpf->ctx, -1, seen, 1, -2);
+    Py_DECREF(seen);
+    DUKPY_STAT_TIMER_STOP(dpf->ctx, conversionTime, convStart);
+    duk_pop_3(dpf->ctx); // [...]
+    dukpy_release_now(dpf->ctx);
+
+    return ret;
+}
+
+static PyObject *DukPy_get_many_dpf(PyObject *self, PyObject *args) {
+    PyObject *pydpf;
+    PyObject *pykeys;
+
+    if (!PyArg_ParseTuple(args, "OO", &pydpf, &pykeys))
+        return NULL;
+
+    if (!PyCapsule_CheckExact(pydpf)) {
+        PyErr_SetString(PyExc_ValueError, "must provide a PyDukFunction");
+        return NULL;
+    }
+
+    struct DukPyFunction* dpf = (struct DukPyFunction*)PyCapsule_GetPointer(pydpf, DUKPY_FUNCTION_CAPSULE_NAME);
+    if (!dpf) {
+        PyErr_SetString(PyExc_ValueError, "must provide a PyDukFunction");
+        return NULL;
+    }
+
+    if (!dukpy_check_owner(dpf->ctx)) {
+        return NULL;
+    }
+
+    PyObject* keys = PySequence_Fast(pykeys, "must provide a sequence of keys");
+    if (!keys) {
+        return NULL;
+    }
+
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(keys);
+    PyObject* values = PyTuple_New(count);
+    PyObject* seen = PyDict_New();
+    if (!values || !seen) {
+        Py_XDECREF(values);
+        Py_XDECREF(seen);
+        Py_DECREF(keys);
+        return NULL;
+    }
+
+    duk_context *ctx = dpf->ctx;
+    duk_push_global_stash(ctx); // [... gstash]
+    duk_get_prop_string(ctx, -1, dpf->name); // [... gstash obj]
+
+    DUKPY_STAT_TIMER_START(convStart);
+    for (Py_ssize_t i = 0; i < count; i++) {
+        PyObject* pykey = PySequence_Fast_GET_ITEM(keys, i);
+        const char* keycesu8 = DUKPY_IS_NSTRING(pykey) ? dukpy_nstring_to_char(pykey) : NULL;
+        if (!keycesu8) {
+            if (!PyErr_Occurred()) {
+                PyErr_SetString(PyExc_ValueError, "keys must be strings");
+            }
+            duk_pop_2(ctx); // [...]
+            Py_DECREF(seen);
+            Py_DECREF(values);
+            Py_DECREF(keys);
+            return NULL;
+        }
+
+        duk_get_prop_string(ctx, -1, keycesu8); // [... gstash obj prop]
+        // seen is shared, so repeated objects come back as the same JSObject
+        PyObject* value = dukpy_pyobj_from_stack(ctx, -1, seen, 1, -2);
+        duk_pop(ctx); // [... gstash obj]
+        if (!value) {
+            duk_pop_2(ctx); // [...]
+            Py_DECREF(seen);
+            Py_DECREF(values);
+            Py_DECREF(keys);
+            return NULL;
+        }
+        PyTuple_SET_ITEM(values, i, value);
+    }
+    DUKPY_STAT_TIMER_STOP(ctx, conversionTime, convStart);
+    duk_pop_2(ctx); // [...]
+    dukpy_release_now(ctx);
+
+    Py_DECREF(seen);
+    Py_DECREF(keys);
+    return values;
+}
+
+static PyObject *DukPy_slice_dpf(PyObject *self, PyObject *args) {
+    PyObject *pydpf;
+    Py_ssize_t start;
+    Py_ssize_t count;
+
+    if (!PyArg_ParseTuple(args, "Onn", &pydpf, &start, &count))
+        return NULL;
+
+    if (!PyCapsule_CheckExact(pydpf)) {
+        PyErr_SetString(PyExc_ValueError, "must provide a PyDukFunction");
+        return NULL;
+    }
+
+    struct DukPyFunction* dpf = (struct DukPyFunction*)PyCapsule_GetPointer(pydpf, DUKPY_FUNCTION_CAPSULE_NAME);
+    if (!dpf) {
+        PyErr_SetString(PyExc_ValueError, "must provide a PyDukFunction");
+        return NULL;
+    }
+
+    if (!dukpy_check_owner(dpf->ctx)) {
+        return NULL;
+    }
+
+    duk_context *ctx = dpf->ctx;
+    duk_push_global_stash(ctx); // [... gstash]
+    duk_get_prop_string(ctx, -1, dpf->name); // [... gstash arr]
+
+    if (!duk_is_array(ctx, -1)) {
+        duk_pop_2(ctx); // [...]
+        Py_RETURN_NONE;
+    }
+
+    // clip to the current length, the array may have changed between chunks
+    Py_ssize_t length = (Py_ssize_t)duk_get_length(ctx, -1);
+    if (start < 0) {
+        start = 0;
+    }
+    if (count < 0 || start > length) {
+        count = 0;
+    }
+    if (count > length - start) {
+        count = length - start;
+    }
+
+    PyObject* values = PyList_New(count);
+    PyObject* seen = PyDict_New();
+    if (!values || !seen) {
+        Py_XDECREF(values);
+        Py_XDECREF(seen);
+        duk_pop_2(ctx); // [...]
+        return NULL;
+    }
+
+    DUKPY_STAT_TIMER_START(convStart);
+    for (Py_ssize_t i = 0; i < count; i++) {
+        duk_get_prop_index(ctx, -1, (duk_uarridx_t)(start + i)); // [... gstash arr value]
+        PyObject* value = dukpy_pyobj_from_stack(ctx, -1, seen, 1, -2);
+        duk_pop(ctx); // [... gstash arr]
+        if (!value) {
+            duk_pop_2(ctx); // [...]
+            Py_DECREF(seen);
+            Py_DECREF(values);
+            return NULL;
+        }
+        PyList_SET_ITEM(values, i, value);
+    }
+    DUKPY_STAT_TIMER_STOP(ctx, conversionTime, convStart);
+    duk_pop_2(ctx); // [...]
+    dukpy_release_now(ctx);
+
+    Py_DECREF(seen);
+    return values;
+}
+
+static PyObject *DukPy_keys_dpf(PyObject *self, PyObject *args) {
+    PyObject *pydpf;
+
+    if (!PyArg_ParseTuple(args, "O", &pydpf))
+        return NULL;
+
+    if (!PyCapsule_CheckExact(pydpf)) {
+        PyErr_SetString(PyExc_ValueError, "must provide a PyDukFunction");
+        return NULL;
+    }
+
+    struct DukPyFunction* dpf = (struct DukPyFunction*)PyCapsule_GetPointer(pydpf, DUKPY_FUNCTION_CAPSULE_NAME);
+    if (!dpf) {
+        PyErr_SetString(PyExc_ValueError, "must provide a PyDukFunction");
+        return NULL;
+    }
+
+    if (!dukpy_check_owner(dpf->ctx)) {
+        return NULL;
+    }
+
+    PyObject* keys = PyList_New(0);
+    if (!keys) {
+        return NULL;
+    }
+
+    PyObject* seen = PyDict_New();
+    if (!seen) {
+        Py_DECREF(keys);
+        return NULL;
+    }
+
+    duk_context *ctx = dpf->ctx;
+    duk_push_global_stash(ctx); // [... gstash]
+    duk_get_prop_string(ctx, -1, dpf->name); // [... gstash obj]
+
+    // own enumerable properties, in the same order as Object.keys
+    duk_enum(ctx, -1, DUK_ENUM_OWN_PROPERTIES_ONLY); // [... gstash obj enum]
+    while (duk_next(ctx, -1, 0)) { // [... gstash obj enum key]
+        PyObject* pykey = dukpy_pyobj_from_stack(ctx, -1, seen, 0, 0);
+        duk_pop(ctx); // [... gstash obj enum]
+        if (!pykey || PyList_Append(keys, pykey) != 0) {
+            Py_XDECREF(pykey);
+            Py_DECREF(seen);
+            Py_DECREF(keys);
+            duk_pop_3(ctx); // [...]
+            return NULL;
+        }
+        Py_DECREF(pykey);
+    }
+    duk_pop_3(ctx); // [...]
+    dukpy_release_now(ctx);
+
+    Py_DECREF(seen);
+    return keys;
+}
+
+static PyObject *DukPy_update_dpf(PyObject *self, PyObject *args) {
+    PyObject *pydpf;
+    PyObject *pyitems;
+
+    if (!PyArg_ParseTuple(args, "OO", &pydpf, &pyitems))
+        return NULL;
+
+    if (!PyCapsule_CheckExact(pydpf)) {
+        PyErr_SetString(PyExc_ValueError, "must provide a PyDukFunction");
+        return NULL;
+    }
+
+    struct DukPyFunction* dpf = (struct DukPyFunction*)PyCapsule_GetPointer(pydpf, DUKPY_FUNCTION_CAPSULE_NAME);
+    if (!dpf) {
+        PyErr_SetString(PyExc_ValueError, "must provide a PyDukFunction");
+        return NULL;
+    }
+
+    if (!dukpy_check_owner(dpf->ctx)) {
+        return NULL;
+    }
+
+    PyObject* items = PySequence_Fast(pyitems, "must provide a sequence of (key, value) pairs");
+    if (!items) {
+        return NULL;
+    }
+
+    duk_context *ctx = dpf->ctx;
+    duk_push_global_stash(ctx); // [... gstash]
+    duk_get_prop_string(ctx, -1, dpf->name); // [... gstash obj]
+
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(items);
+    for (Py_ssize_t i = 0; i < count; i++) {
+        PyObject* item = PySequence_Fast_GET_ITEM(items, i);
+        if (!PyTuple_Check(item) || PyTuple_GET_SIZE(item) != 2 || !DUKPY_IS_NSTRING(PyTuple_GET_ITEM(item, 0))) {
+            PyErr_SetString(PyExc_ValueError, "must provide (key, value) pairs with string keys");
+            break;
+        }
+
+        const char* keycesu8 = dukpy_nstring_to_char(PyTuple_GET_ITEM(item, 0));
+        if (!keycesu8) {
+            break;
+        }
+
+        PyObject* value = PyTuple_GET_ITEM(item, 1);
+        Py_INCREF(value);
+        if (dukpy_wrap_a_python_object_somehow_and_return_it(ctx, value) != 1) { // [... gstash obj value]
+            Py_DECREF(value);
+            dukpy_set_python_error_from_js_error(ctx);
+            break;
+        }
+        duk_put_prop_string(ctx, -2, keycesu8); // [... gstash obj]
+    }
+    duk_pop_2(ctx); // [...]
+    dukpy_release_now(ctx);
+    Py_DECREF(items);
+
+    if (PyErr_Occurred()) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *DukPy_set_item_dpf(PyObject *self, PyObject *args) {
+    PyObject *pydpf;
+    PyObject *pykey;
+    PyObject *pyvalue;
+
+    if (!PyArg_ParseTuple(args, "OOO", &pydpf, &pykey, &pyvalue))
+        return NULL;
+
+    if (!pydpf) {
+        PyErr_SetString(PyExc_ValueError, "must provide a PyDukFunction");
+        return NULL;
+    }
+
+    if (!PyCapsule_CheckExact(pydpf)) {
+        PyErr_SetString(PyExc_ValueError, "must provide a PyDukFunction");
+        return NULL;
+    }
+
+    struct DukPyFunction* dpf = (struct DukPyFunction*)PyCapsule_GetPointer(pydpf, DUKPY_FUNCTION_CAPSULE_NAME);
     if (!dpf) {
         PyErr_SetString(PyExc_ValueError, "must provide a PyDukFunction");
         return NULL;
     }
 
+    if (!dukpy_check_owner(dpf->ctx)) {
+        return NULL;
+    }
+
     if (!pykey || !DUKPY_IS_NSTRING(pykey)) {
         PyErr_SetString(PyExc_ValueError, "must provide a key");
         return NULL;
@@ -1480,6 +4047,7 @@ static PyObject *DukPy_set_item_dpf(PyObject *self, PyObject *args) {
     duk_put_prop_string(dpf->ctx, -2, keycesu8); // [... gstash func]
 
     duk_pop_2(dpf->ctx); // [...]
+    dukpy_release_now(dpf->ctx);
 
     Py_RETURN_NONE;
 }
@@ -1488,10 +4056,36 @@ static PyObject *DukPy_set_item_dpf(PyObject *self, PyObject *args) {
 static PyMethodDef DukPy_methods[] = {
     {"new_context", DukPy_create_context, METH_VARARGS, "Create a new DukPy context."},
     {"ctx_eval_string", DukPy_eval_string_ctx, METH_VARARGS, "Run Javascript code from a string in a given context."},
+    {"ctx_eval_chunks", DukPy_eval_chunks_ctx, METH_VARARGS, "Run a sequence of Javascript code chunks in a given context."},
+    {"ctx_eval_file", DukPy_eval_file_ctx, METH_VARARGS, "Run a Javascript file in a given context."},
+    {"load_file", DukPy_load_file, METH_VARARGS, "Load a UTF-8 source file into a string."},
+    {"ctx_compile_file", DukPy_compile_file_ctx, METH_VARARGS, "Compile a wrapped source file into a function and its bytecode."},
+    {"ctx_compile_source", DukPy_compile_source_ctx, METH_VARARGS, "Compile wrapped UTF-8 source bytes into a function and its bytecode."},
+    {"ctx_load_function", DukPy_load_function_ctx, METH_VARARGS, "Load a function from bytecode."},
+    {"compile_bytecode", DukPy_compile_bytecode, METH_VARARGS, "Compile a function to bytecode without a context, releasing the GIL."},
+    {"ctx_install_require", DukPy_install_require_ctx, METH_VARARGS, "Install the native require() backed by a Python module loader."},
+    {"ctx_install_process_env", DukPy_install_process_env_ctx, METH_VARARGS, "Install process.env as a read-through view of the environment."},
+    {"ctx_set_gc_policy", DukPy_set_gc_policy_ctx, METH_VARARGS, "Choose when a given context forces garbage collection."},
+    {"ctx_gc", DukPy_gc_ctx, METH_VARARGS, "Run garbage collection in a given context."},
+    {"ctx_gc_stats", DukPy_gc_stats_ctx, METH_VARARGS, "Get garbage collection counters for a given context."},
+    {"ctx_allocator_stats", DukPy_allocator_stats_ctx, METH_VARARGS, "Get allocator counters for a given context."},
+    {"ctx_set_memory_limit", DukPy_set_memory_limit_ctx, METH_VARARGS, "Limit how much memory a given context may use."},
+    {"ctx_memory_stats", DukPy_memory_stats_ctx, METH_VARARGS, "Get memory usage counters for a given context."},
+    {"ctx_set_deadlines", DukPy_set_deadlines_ctx, METH_VARARGS, "Tighten the wall and CPU time budgets of a given context."},
+    {"ctx_restore_deadlines", DukPy_restore_deadlines_ctx, METH_VARARGS, "Restore budgets returned by ctx_set_deadlines."},
+    {"ctx_interrupt", DukPy_interrupt_ctx, METH_VARARGS, "Abort whatever a given context is running."},
+    {"ctx_profile_start", DukPy_profile_start_ctx, METH_VARARGS, "Start sampling the callstack of a given context."},
+    {"ctx_profile_stop", DukPy_profile_stop_ctx, METH_VARARGS, "Stop sampling and return the collapsed stacks."},
+    {"ctx_stats", DukPy_stats_ctx, METH_VARARGS, "Get bridge instrumentation counters for a given context."},
     {"ctx_add_global_object", DukPy_add_global_object_ctx, METH_VARARGS, "Add an object to the global context."},
     {"dpf_exec", DukPy_exec_dpf, METH_VARARGS, "Execute a DukPyFunction."},
+    {"dpf_map", DukPy_map_dpf, METH_VARARGS, "Call a JS function once for every item of an iterable."},
     {"dpf_get_item", DukPy_get_item_dpf, METH_VARARGS, "Get an attribute on a DukPyFunction."},
     {"dpf_set_item", DukPy_set_item_dpf, METH_VARARGS, "Set an attribute on a DukPyFunction."},
+    {"dpf_get_many", DukPy_get_many_dpf, METH_VARARGS, "Get several attributes of a DukPyFunction at once."},
+    {"dpf_update", DukPy_update_dpf, METH_VARARGS, "Set several attributes on a DukPyFunction at once."},
+    {"dpf_slice", DukPy_slice_dpf, METH_VARARGS, "Get a range of elements of a DukPyFunction which is an array."},
+    {"dpf_keys", DukPy_keys_dpf, METH_VARARGS, "Get the own enumerable keys of a DukPyFunction."},
     {NULL, NULL, 0, NULL}
 };
 
@@ -1518,6 +4112,21 @@ PyInit__dukpy(void)
     DukPyError = PyErr_NewException("_dukpy.JSRuntimeError", NULL, NULL);
     Py_INCREF(DukPyError);
     PyModule_AddObject(module, "JSRuntimeError", DukPyError);
+
+    DukPyInterruptedError = PyErr_NewException("_dukpy.JSInterruptedError", DukPyError, NULL);
+    Py_INCREF(DukPyInterruptedError);
+    PyModule_AddObject(module, "JSInterruptedError", DukPyInterruptedError);
+
+    DukPyTimeoutError = PyErr_NewException("_dukpy.JSTimeoutError", DukPyInterruptedError, NULL);
+    Py_INCREF(DukPyTimeoutError);
+    PyModule_AddObject(module, "JSTimeoutError", DukPyTimeoutError);
+
+#ifdef DUKPY_STATS
+    PyModule_AddIntConstant(module, "STATS_ENABLED", 1);
+#else
+    PyModule_AddIntConstant(module, "STATS_ENABLED", 0);
+#endif
+    PyModule_AddIntConstant(module, "DUK_VERSION", DUK_VERSION);
     return module;
 }
 
@@ -1533,6 +4142,21 @@ init_dukpy(void)
     DukPyError = PyErr_NewException("_dukpy.JSRuntimeError", NULL, NULL);
     Py_INCREF(DukPyError);
     PyModule_AddObject(module, "JSRuntimeError", DukPyError);
+
+    DukPyInterruptedError = PyErr_NewException("_dukpy.JSInterruptedError", DukPyError, NULL);
+    Py_INCREF(DukPyInterruptedError);
+    PyModule_AddObject(module, "JSInterruptedError", DukPyInterruptedError);
+
+    DukPyTimeoutError = PyErr_NewException("_dukpy.JSTimeoutError", DukPyInterruptedError, NULL);
+    Py_INCREF(DukPyTimeoutError);
+    PyModule_AddObject(module, "JSTimeoutError", DukPyTimeoutError);
+
+#ifdef DUKPY_STATS
+    PyModule_AddIntConstant(module, "STATS_ENABLED", 1);
+#else
+    PyModule_AddIntConstant(module, "STATS_ENABLED", 0);
+#endif
+    PyModule_AddIntConstant(module, "DUK_VERSION", DUK_VERSION);
 }
 
 #endif
@@ -11,8 +11,18 @@ try:
 except IOError:
     README = ''
 
+define_macros = [('DUK_OPT_DEEP_C_STACK', '1'),
+                 # execution budgets and ctx.interrupt()
+                 ('DUK_OPT_INTERRUPT_COUNTER', '1'),
+                 ('DUK_OPT_EXEC_TIMEOUT_CHECK(udata)', 'dukpy_exec_timeout_check(udata)'),
+                 ('DUK_OPT_DECLARE', 'extern int dukpy_exec_timeout_check(void *udata);')]
+
+# ctx.stats() counters, they cost every conversion so build with DUKPY_STATS=1 to have them
+if os.environ.get('DUKPY_STATS', '0') != '0':
+    define_macros.append(('DUKPY_STATS', '1'))
+
 duktape = Extension('dukpy._dukpy',
-                    define_macros=[('DUK_OPT_DEEP_C_STACK', '1')],
+                    define_macros=define_macros,
                     extra_compile_args = ['-std=c99', '-Os', '-fomit-frame-pointer', '-fstrict-aliasing'],
                     sources=[os.path.join('duktape', 'duktape.c'), 
                              'pyduktape.c'],
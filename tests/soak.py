@@ -0,0 +1,177 @@
+"""Soak test for long lived contexts.
+
+Runs a mix of evaluations, Python callbacks, exceptions in both directions
+and JSObject handle traffic against a single context, sampling RSS, the
+number of objects tracked by Python's GC, the Duktape heap size and the
+number of global stash entries as it goes. Exits non-zero when any of them
+grew past its threshold between the end of the warm up and the end of the
+run::
+
+    python tests/soak.py --iterations 1000000 --csv soak.csv
+
+It's not part of the regular test run, it takes far too long for that.
+"""
+from __future__ import print_function
+
+import argparse
+import gc
+import os
+import resource
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+
+import dukpy  # noqa: E402
+from dukpy.evaljs import ALLOCATORS  # noqa: E402
+
+
+def rss_bytes():
+    try:
+        with open('/proc/self/statm') as f:
+            return int(f.read().split()[1]) * resource.getpagesize()
+    except IOError:
+        # peak rather than current, but better than nothing
+        rss = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+        return rss if sys.platform == 'darwin' else rss * 1024
+
+
+class Workload(object):
+    """One round of every kind of operation the bridge supports"""
+
+    def __init__(self, ctx):
+        self.ctx = ctx
+        self.counter = 0
+        ctx.define_global('echo', lambda value: value)
+        ctx.define_global('make', lambda n: {'n': n, 'items': list(range(n)), 'name': 'x' * n})
+        ctx.define_global('fail', self.fail)
+        ctx.evaljs('''
+            var kept = {};
+            function Thing(n) { this.n = n; this.label = 'thing ' + n; }
+            Thing.prototype.twice = function() { return this.n * 2; };
+            function makeThing(n) { return new Thing(n); }
+            function thrower(message) { throw new Error(message); }
+        ''')
+
+    def fail(self, message):
+        raise ValueError(message)
+
+    def run(self, i):
+        ctx = self.ctx
+        self.counter += 1
+
+        # plain evaluation with variables, results of every type
+        ctx.evaljs('dukpy.a + dukpy.b', a=i, b=1.5)
+        ctx.evaljs('dukpy.s + "!"', s='value %d' % i)
+        ctx.evaljs('[1, "two", null, true, 2.5]')
+
+        # callbacks into Python returning fresh objects
+        ctx.evaljs('echo("string " + dukpy.i).length', i=i)
+        ctx.evaljs('var m = make(dukpy.n); m.items.length + m.name.length + m.n', n=i % 16)
+
+        # JavaScript errors caught in Python
+        try:
+            ctx.evaljs('thrower("boom " + dukpy.i)', i=i)
+        except dukpy.JSRuntimeError:
+            pass
+
+        # Python errors raised through JavaScript, caught both ways
+        try:
+            ctx.evaljs('fail("python " + dukpy.i)', i=i)
+        except ValueError:
+            pass
+        ctx.evaljs('try { fail("caught"); } catch (e) { e.message }')
+
+        # JSObject handles: create, call, read, write, drop
+        thing = ctx.evaljs('makeThing(dukpy.i)', i=i)
+        thing.twice()
+        thing['label']
+        thing['extra'] = {'i': i}
+        fn = ctx.evaljs('(function(x) { return [x, x]; })')
+        fn(i)
+        del thing, fn
+
+        # Python objects parked in and removed from JavaScript state
+        ctx.evaljs('kept[dukpy.k] = dukpy.v', k='key%d' % (i % 8), v={'i': i})
+        if i % 8 == 7:
+            ctx.evaljs('kept = {}')
+
+
+def sample(ctx):
+    gc.collect()
+    ctx.gc(compact=True)
+    stats = ctx.memory_stats()
+    return {
+        'rss': rss_bytes(),
+        'py_objects': len(gc.get_objects()),
+        'heap_bytes': stats['live_bytes'],
+        'stash_entries': stats['stash_entries'],
+    }
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--iterations', type=int, default=200000)
+    parser.add_argument('--samples', type=int, default=20,
+                        help='how many times to sample along the way')
+    parser.add_argument('--warmup', type=float, default=0.1,
+                        help='fraction of the run before the baseline sample')
+    parser.add_argument('--max-rss-growth', type=int, default=16 * 1024 * 1024)
+    parser.add_argument('--max-object-growth', type=int, default=1000)
+    parser.add_argument('--max-heap-growth', type=int, default=1024 * 1024)
+    parser.add_argument('--max-stash-growth', type=int, default=100)
+    parser.add_argument('--allocator', default='pymem', choices=sorted(ALLOCATORS))
+    parser.add_argument('--csv', help='write every sample to this file')
+    args = parser.parse_args(argv)
+
+    ctx = dukpy.Context(allocator=args.allocator)
+    workload = Workload(ctx)
+
+    every = max(1, args.iterations // args.samples)
+    warmup = int(args.iterations * args.warmup)
+    samples = []
+    baseline = None
+    start = time.time()
+
+    columns = ('iteration', 'elapsed', 'rss', 'py_objects', 'heap_bytes', 'stash_entries')
+    print(' '.join('{0:>14}'.format(c) for c in columns))
+    for i in range(args.iterations):
+        workload.run(i)
+        if i == warmup or (i + 1) % every == 0 or i + 1 == args.iterations:
+            s = sample(ctx)
+            s['iteration'] = i + 1
+            s['elapsed'] = round(time.time() - start, 1)
+            samples.append(s)
+            if i == warmup:
+                baseline = s
+            print(' '.join('{0:>14}'.format(s[c]) for c in columns))
+            sys.stdout.flush()
+
+    if args.csv:
+        with open(args.csv, 'w') as f:
+            f.write(','.join(columns) + '\n')
+            for s in samples:
+                f.write(','.join(str(s[c]) for c in columns) + '\n')
+
+    if baseline is None:
+        baseline = samples[0]
+    final = samples[-1]
+    limits = (
+        ('rss', args.max_rss_growth),
+        ('py_objects', args.max_object_growth),
+        ('heap_bytes', args.max_heap_growth),
+        ('stash_entries', args.max_stash_growth),
+    )
+    failed = False
+    for key, limit in limits:
+        growth = final[key] - baseline[key]
+        status = 'ok'
+        if growth > limit:
+            status = 'FAILED'
+            failed = True
+        print('{0:14} grew by {1:>12} (limit {2:>12}) {3}'.format(key, growth, limit, status))
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -1,7 +1,7 @@
 from __future__ import unicode_literals
 import json
 import dukpy
-from dukpy.webassets import BabelJS
+from dukpy.webassets import BabelJS, TypeScript, CoffeeScript
 try:
     from io import StringIO
 except:
@@ -31,4 +31,49 @@ class Point {
         assert '''var Point = (function () {
     function Point(x, y) {
 ''' in ans, ans
-     
+
+    def test_filters_share_warm_compilers(self):
+        out = StringIO()
+        TypeScript().input(StringIO('var n: number = 1;'), out, source_path='n.ts')
+        assert out.getvalue() == 'var n = 1;\n', out.getvalue()
+        # the pooled compiler doesn't hold on to what it compiled
+        from dukpy.pool import get_pool
+        compiler = get_pool('typescript')._idle.get()
+        try:
+            assert compiler.stats()['files'] == 0
+        finally:
+            get_pool('typescript')._idle.put(compiler)
+
+        out = StringIO()
+        CoffeeScript().input(StringIO('a = 1'), out)
+        assert out.getvalue() == dukpy.coffee_compile('a = 1')
+
+        before = CoffeeScript.stats()
+        CoffeeScript().input(StringIO('b = 2'), StringIO())
+        after = CoffeeScript.stats()
+        assert after['compiles'] == before['compiles'] + 1
+        assert after['compilers'] == 1
+
+        assert CoffeeScript().unique() == CoffeeScript().unique()
+        assert CoffeeScript().unique() != TypeScript().unique()
+
+    def test_compiler_pool_is_thread_safe(self):
+        import threading
+        from dukpy.pool import CompilerPool
+        pool = CompilerPool('coffee', size=2)
+        results = {}
+
+        def compile(n):
+            results[n] = pool.compile('a = {0}'.format(n))
+
+        threads = [threading.Thread(target=compile, args=(n,)) for n in range(6)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+
+        for n in range(6):
+            assert 'a = {0};'.format(n) in results[n], results[n]
+        stats = pool.stats()
+        assert stats['compiles'] == 6
+        assert 1 <= stats['compilers'] <= 2
@@ -1,3 +1,4 @@
+import contextlib
 import json
 import os.path
 import dukpy
@@ -77,6 +78,133 @@ var greeter = new Greeter("Hello, world!");"""
 
         assert expected in ans, report_diff(expected, ans)
 
+    def test_typescript_compiler(self):
+        source = '''
+class Greeter {
+    constructor(public greeting: string) { }
+}
+'''
+        tsc = dukpy.TypeScriptCompiler()
+        first = tsc.compile(source, 'greeter.ts')
+        assert first == dukpy.typescript_compile(source), report_diff(dukpy.typescript_compile(source), first)
+        other = tsc.compile('var n: number = 1;', 'other.ts')
+        assert other == 'var n = 1;\n', other
+
+        assert tsc.compile(source, 'greeter.ts') == first
+        assert tsc.stats() == {'files': 2, 'hits': 1, 'misses': 2}
+
+        changed = tsc.compile(source.replace('Greeter', 'Welcomer'), 'greeter.ts')
+        assert 'function Welcomer(greeting)' in changed, changed
+        assert tsc.stats()['misses'] == 3
+
+        tsc.remove('other.ts')
+        assert tsc.stats()['files'] == 1
+        assert tsc.compile('let x = 1;', 'other.ts') == 'var x = 1;\n'
+
+        assert dukpy.TypeScriptCompiler({'target': 2}).compile('let x = 1;') == 'let x = 1;\n'
+
+
+    def test_compiler_sessions_give_source_maps(self):
+        code, source_map = dukpy.BabelCompiler({'sourceMap': True}).transform('let a = () => 1;', 'a.js')
+        assert 'var a = function' in code, code
+        assert json.loads(source_map)['sources'] == ['a.js'], source_map
+        assert dukpy.BabelCompiler().transform('let a = 1;')[1] is None
+
+        code, source_map = dukpy.CoffeeCompiler({'sourceMap': True}).transform('a = 1', 'a.coffee')
+        assert 'a = 1;' in code, code
+        assert json.loads(source_map)['mappings'], source_map
+        assert dukpy.CoffeeCompiler().compile('a = 1') == dukpy.coffee_compile('a = 1')
+
+    def test_incremental_compiler(self):
+        import shutil, tempfile, time
+        from dukpy.incremental import IncrementalCompiler
+        root = tempfile.mkdtemp()
+        try:
+            src, out, cache = (os.path.join(root, d) for d in ('src', 'out', 'cache'))
+            os.makedirs(os.path.join(src, 'lib'))
+            for name, source in (('main.coffee', 'a = 1'), ('lib/util.coffee', 'b = 2'), ('skip.txt', '')):
+                with open(os.path.join(src, name), 'w') as f:
+                    f.write(source)
+
+            compiler = IncrementalCompiler('coffee', cache_dir=cache)
+            written = compiler.build(src, out)
+            assert sorted(written) == [os.path.join(out, 'lib', 'util.js'), os.path.join(out, 'main.js')]
+            with open(os.path.join(out, 'lib', 'util.js')) as f:
+                assert f.read() == dukpy.coffee_compile('b = 2')
+            assert compiler.build(src, out) == []
+
+            time.sleep(0.01)
+            with open(os.path.join(src, 'main.coffee'), 'w') as f:
+                f.write('a = 30')
+            assert compiler.build(src, out) == [os.path.join(out, 'main.js')]
+            assert compiler.stats()['misses'] == 3
+
+            # another build with the same cache doesn't even load CoffeeScript
+            shutil.rmtree(out)
+            compiler = IncrementalCompiler('coffee', cache_dir=cache)
+            assert len(compiler.build(src, out)) == 2
+            assert compiler.stats() == {'hits': 2, 'misses': 0, 'errors': 0, 'compiler_loaded': False}
+            with open(os.path.join(out, 'main.js')) as f:
+                assert 'a = 30;' in f.read()
+
+            # different options are different entries
+            compiler = IncrementalCompiler('coffee', cache_dir=cache, options={'bare': True})
+            assert compiler.compile('a = 3') == dukpy.CoffeeCompiler({'bare': True}).compile('a = 3')
+            assert compiler.stats()['misses'] == 1
+        finally:
+            shutil.rmtree(root)
+
+    def test_incremental_compiler_survives_errors(self):
+        import shutil, tempfile, time
+        from dukpy.incremental import IncrementalCompiler
+        root = tempfile.mkdtemp()
+        try:
+            src, out = os.path.join(root, 'src'), os.path.join(root, 'out')
+            os.makedirs(src)
+            for name, source in (('bad.coffee', 'a = ('), ('good.coffee', 'b = 2')):
+                with open(os.path.join(src, name), 'w') as f:
+                    f.write(source)
+
+            failed = []
+            compiler = IncrementalCompiler('coffee', max_outputs=1)
+            written = compiler.build(src, out, on_error=lambda path, e: failed.append(path))
+            assert written == [os.path.join(out, 'good.js')]
+            assert failed == [os.path.join(src, 'bad.coffee')]
+            assert 'missing )' in str(compiler.errors[os.path.join(src, 'bad.coffee')])
+
+            # the broken file is retried until it compiles
+            assert compiler.build(src, out) == []
+            assert compiler.stats()['misses'] == 3
+            time.sleep(0.01)
+            with open(os.path.join(src, 'bad.coffee'), 'w') as f:
+                f.write('a = (1)')
+            assert compiler.build(src, out) == [os.path.join(out, 'bad.js')]
+            assert compiler.errors == {}
+            assert len(compiler._outputs) == 1
+
+            # deleted sources take their output with them
+            os.remove(os.path.join(src, 'good.coffee'))
+            assert compiler.build(src, out) == []
+            assert os.listdir(out) == ['bad.js']
+        finally:
+            shutil.rmtree(root)
+
+    def test_incremental_compiler_skips_nested_output(self):
+        import shutil, tempfile
+        from dukpy.incremental import IncrementalCompiler
+        src = tempfile.mkdtemp()
+        try:
+            out, cache = os.path.join(src, 'build'), os.path.join(src, '.cache')
+            with open(os.path.join(src, 'main.js'), 'w') as f:
+                f.write('let a = 1;')
+
+            compiler = IncrementalCompiler('babel', cache_dir=cache)
+            assert compiler.build(src, out) == [os.path.join(out, 'main.js')]
+            assert compiler.build(src, out) == []
+            assert compiler.stats()['misses'] == 1
+            assert os.listdir(out) == ['main.js']
+        finally:
+            shutil.rmtree(src)
 
 class TestContext(object):
     def test_can_construct_context(self):
@@ -92,6 +220,324 @@ class TestContext(object):
         c.evaljs("aardvark = 'lemon'")
         assert c.evaljs("aardvark") == 'lemon'
 
+    def test_evaljs_chunks(self):
+        c = dukpy.Context()
+        ret = c.evaljs(["var o = {'value': 5}", b"o['value'] += 3", "o.value"])
+        assert ret == 8
+
+        # a joined compilation unit has a single filename
+        try:
+            c.evaljs(["var x = 1", ("named.js", "x")])
+            assert False
+        except TypeError:
+            pass
+
+    def test_evaljs_units(self):
+        c = dukpy.Context()
+        ret = c.evaljs_units([("first.js", "var x = 5"), b"x + dukpy.y"], y=2)
+        assert ret == 7
+
+    def test_evaljs_units_report_filename(self):
+        c = dukpy.Context()
+        ret = c.evaljs_units([("broken.js", "function f() { throw new Error('no'); }"),
+                              "var s; try { f(); } catch (e) { s = e.stack; } s"])
+        assert 'broken.js' in ret, ret
+
+    def test_evaljs_file(self):
+        import tempfile
+        with tempfile.NamedTemporaryFile(suffix='.js', delete=False) as f:
+            f.write(b"\xef\xbb\xbfvar fromFile = dukpy.value;\n"
+                    b"function boom() { throw new Error('boom'); }")
+        try:
+            c = dukpy.Context()
+            c.evaljs_file(f.name, value=12)
+            assert c.evaljs("fromFile") == 12
+            stack = c.evaljs("var s; try { boom(); } catch (e) { s = e.stack; } s")
+            assert f.name in stack, stack
+        finally:
+            os.unlink(f.name)
+
+    def test_evaljs_file_missing(self):
+        c = dukpy.Context()
+        try:
+            c.evaljs_file(os.path.join(os.path.dirname(__file__), 'does-not-exist.js'))
+            assert False
+        except IOError:
+            pass
+
+    def test_gc_policy_every(self):
+        c = dukpy.Context(gc_policy='every', gc_interval=2)
+        for _ in range(4):
+            c.evaljs("1")
+        assert c.gc_stats()['collections'] == 2
+
+    def test_gc_policy_never(self):
+        c = dukpy.Context()
+        for _ in range(4):
+            c.evaljs("1")
+        assert c.gc_stats()['collections'] == 0
+
+    def test_gc_policy_threshold(self):
+        c = dukpy.Context(gc_policy='threshold', gc_threshold=1024 * 1024)
+        c.evaljs("1")
+        assert c.gc_stats()['collections'] == 0
+        c.evaljs("var a = []; for (var i = 0; i < 100000; i++) { a.push({i: i}); }")
+        c.evaljs("1")
+        assert c.gc_stats()['collections'] == 1
+
+    def test_explicit_gc(self):
+        c = dukpy.Context()
+        c.evaljs("var big = []; for (var i = 0; i < 1000; i++) { big.push([i]); } big = null;")
+        c.gc(compact=True)
+        stats = c.gc_stats()
+        assert stats['collections'] == 1
+        assert stats['time'] >= 0
+
+    def test_unknown_gc_policy(self):
+        try:
+            dukpy.Context(gc_policy='sometimes')
+            assert False
+        except ValueError:
+            pass
+
+    def test_allocators(self):
+        for allocator in ('pymem', 'pool', 'arena'):
+            c = dukpy.Context(allocator=allocator)
+            ret = c.evaljs("""
+                var a = [];
+                for (var i = 0; i < 20000; i++) { a.push({i: i, s: 'str' + i}); }
+                a[19999].s + a.length
+            """)
+            assert ret == 'str1999920000', allocator
+            c.evaljs("a = null")
+            c.gc(compact=True)
+            stats = c.allocator_stats()
+            assert stats['allocator'] == allocator
+            assert 0 < stats['used_bytes'] <= stats['reserved_bytes'], stats
+
+    def test_pool_allocator_reuses_blocks(self):
+        c = dukpy.Context(allocator='pool')
+        code = "var a = []; for (var i = 0; i < 5000; i++) { a.push({i: i}); } a = null;"
+        c.evaljs(code)
+        reserved = c.allocator_stats()['reserved_bytes']
+        for _ in range(5):
+            c.evaljs(code)
+        assert c.allocator_stats()['reserved_bytes'] <= reserved * 1.5
+
+    def test_unknown_allocator(self):
+        try:
+            dukpy.Context(allocator='magic')
+            assert False
+        except ValueError:
+            pass
+
+    def test_memory_stats(self):
+        c = dukpy.Context()
+        before = c.memory_stats()
+        c.evaljs("var a = []; for (var i = 0; i < 10000; i++) { a.push({i: i}); }")
+        after = c.memory_stats()
+        assert after['live_bytes'] > before['live_bytes']
+        assert after['peak_bytes'] >= after['live_bytes']
+        assert after['allocations'] > before['allocations']
+
+    def test_memory_limit(self):
+        c = dukpy.Context(max_heap_bytes=4 * 1024 * 1024)
+        try:
+            c.evaljs("(function() { var a = []; while (true) { a.push('grow' + a.length); } })()")
+            assert False
+        except MemoryError:
+            pass
+        assert c.memory_stats()['failed_allocations'] > 0
+        assert c.evaljs("1 + 1") == 2
+
+        # a caught allocation failure doesn't turn later errors into MemoryErrors
+        try:
+            c.evaljs("try { (function() { var a = []; while (true) { a.push('grow' + a.length); } })() } catch (e) {} null.x")
+            assert False
+        except dukpy.JSRuntimeError as e:
+            assert 'TypeError' in str(e)
+
+    def test_timeout(self):
+        c = dukpy.Context()
+        try:
+            with c.budget(timeout=0.05):
+                c.evaljs("while (true) {}")
+            assert False
+        except dukpy.JSTimeoutError:
+            pass
+        assert c.evaljs("1 + 1") == 2
+
+    def test_cpu_timeout(self):
+        c = dukpy.Context()
+        try:
+            with c.budget(cpu_timeout=0.05):
+                c.evaljs("for (;;) {}")
+            assert False
+        except dukpy.JSTimeoutError:
+            pass
+        with c.budget(cpu_timeout=5):
+            assert c.evaljs("for (var i = 0; i < 1000000; i++) {} i") == 1000000
+
+    def test_budget_names_reach_javascript(self):
+        c = dukpy.Context()
+        assert c.evaljs("dukpy.timeout + dukpy.cpu_timeout", timeout=5, cpu_timeout=6) == 11
+
+    def test_running_context_refuses_other_threads(self):
+        import threading
+        c = dukpy.Context()
+        started = threading.Event()
+        release = threading.Event()
+        errors = []
+
+        def wait():
+            started.set()
+            release.wait(5)
+
+        def other_thread():
+            started.wait(5)
+            try:
+                c.evaljs("1")
+            except RuntimeError as e:
+                errors.append(e)
+            finally:
+                release.set()
+
+        c.define_global('wait', wait)
+        t = threading.Thread(target=other_thread)
+        t.start()
+        c.evaljs("wait()")
+        t.join()
+        assert len(errors) == 1
+        assert c.evaljs("1 + 1") == 2
+
+    def test_interrupt(self):
+        import threading
+        c = dukpy.Context()
+        timer = threading.Timer(0.05, c.interrupt)
+        timer.start()
+        try:
+            c.evaljs("while (true) {}")
+            assert False
+        except dukpy.JSInterruptedError:
+            pass
+        finally:
+            timer.cancel()
+        assert c.evaljs("1 + 1") == 2
+
+    def test_profile(self):
+        c = dukpy.Context()
+        c.evaljs_units([('hot.js', '''
+            function inner(n) { var x = 0; for (var i = 0; i < n; i++) { x += i; } return x; }
+            function outer() { var x = inner(3000000); return x; }
+        ''')])
+        with c.profile() as profile:
+            c.evaljs("outer()")
+        assert profile.total > 0
+        assert any(stack.endswith('outer (hot.js);inner (hot.js)') for stack in profile.samples)
+        assert profile.collapsed().endswith('\n')
+
+    def test_profile_samples_the_running_thread(self):
+        c = dukpy.Context()
+        c.evaljs_units([('co.js', '''
+            function spin() { var x = 0; for (var i = 0; i < 3000000; i++) { x += i; } return x; }
+            function body() { Duktape.Thread.yield(spin()); }
+            // what the profiler calls can't be swapped out by scripts
+            Duktape.act = function () { throw new Error('replaced'); };
+        ''')])
+        with c.profile() as profile:
+            c.evaljs("Duktape.Thread.resume(new Duktape.Thread(body))")
+        assert any(stack.endswith('body (co.js);spin (co.js)') for stack in profile.samples)
+
+    def test_stats(self):
+        if not dukpy._dukpy.STATS_ENABLED:
+            raise SkipTest('built without DUKPY_STATS')
+        c = dukpy.Context()
+        c.define_global('add', lambda a, b: a + b)
+        c.define_global('config', {'name': 'dukpy'})
+        f = c.evaljs("add(1, 2); config.name; (function() { return 'abc'; })")
+        assert f() == 'abc'
+        del f
+
+        stats = c.stats()
+        assert stats['python_calls'] == 1
+        assert stats['proxy_traps']['get'] >= 1
+        assert stats['handles_created'] == 1
+        assert stats['handles_released'] == 1
+        assert stats['to_python']['int'] == 2
+        assert stats['to_python']['str'] == 1
+        assert stats['to_javascript']['number'] == 1
+        assert stats['string_bytes_to_python'] == 3
+        assert stats['eval_time'] > 0
+
+    def test_values_passed_to_js_are_released(self):
+        import sys
+        value = ''.join(['not', 'interned'])
+        c = dukpy.Context()
+        c.define_global('get', lambda: value)
+        before = sys.getrefcount(value)
+        for _ in range(10):
+            c.evaljs('get() + dukpy.value', value=value)
+        c.gc(compact=True)
+        assert sys.getrefcount(value) == before
+
+    def test_wrapped_objects_are_released(self):
+        import weakref
+
+        class Thing(object):
+            pass
+
+        thing = Thing()
+        ref = weakref.ref(thing)
+        c = dukpy.Context()
+        c.evaljs('var kept = dukpy.thing', thing=thing)
+        del thing
+        assert ref() is not None
+
+        c.evaljs('kept = null')
+        c.gc()
+        assert ref() is None
+        assert c.gc_stats()['released_references'] > 0
+        assert c.gc_stats()['pending_releases'] == 0
+
+    def test_call_values_are_released_on_return(self):
+        import sys, weakref
+
+        class Thing(object):
+            pass
+
+        c = dukpy.Context()
+        thing = Thing()
+        ref = weakref.ref(thing)
+        c.evaljs('dukpy.thing.x = 1', thing=thing)
+        del thing
+        # gone as soon as evaljs returns, not on the next call
+        assert ref() is None
+        assert c.gc_stats()['pending_releases'] == 0
+
+        class Oops(Exception):
+            pass
+
+        def fail():
+            raise Oops(Thing())
+        c.define_global('fail', fail)
+        try:
+            c.evaljs('fail()')
+            assert False
+        except Oops as e:
+            ref = weakref.ref(e.args[0])
+            e = None
+        if hasattr(sys, 'exc_clear'):
+            sys.exc_clear()  # Python 2 keeps the last exception around
+        assert ref() is None
+        assert c.gc_stats()['pending_releases'] == 0
+
+        func = c.evaljs('(function (thing) { return 1; })')
+        thing = Thing()
+        ref = weakref.ref(thing)
+        func(thing)
+        del thing
+        assert ref() is None
+
     def test_handles_none(self):
         o = dukpy._dukpy.ctx_eval_string
         dukpy._dukpy.ctx_eval_string = lambda *args, **kwargs: None
@@ -106,6 +552,13 @@ class TestPythonToJSObject(object):
         c.define_global("seven", 7)
         assert c.evaljs("seven") == 7
 
+    def test_python2_unicode_is_a_string(self):
+        import sys
+        if sys.version_info[0] >= 3:
+            raise SkipTest('only Python 2 has a separate unicode type')
+        ans = dukpy.evaljs("typeof dukpy.s + ' ' + dukpy.s + ' ' + dukpy.s.length", s=u'caf\xe9')
+        assert ans == u'string caf\xe9 4'.encode('utf-8'), ans
+
     def test_can_pass_callable(self):
         c = dukpy.Context()
         called = {'called': False}
@@ -154,12 +607,74 @@ class TestPythonToJSObject(object):
         assert inc(1) == 2
         assert inc(2) == 3
 
+    def test_can_map_callable(self):
+        c = dukpy.Context()
+
+        inc = c.evaljs("(function(x) { return x + 1; })")
+        assert inc.js_map(range(5)) == [1, 2, 3, 4, 5]
+        assert list(inc.js_imap(range(5), chunk_size=2)) == [1, 2, 3, 4, 5]
+
+        add = c.evaljs("(function(a, b) { return a + b; })")
+        assert add.js_starmap([(1, 2), ('a', 'b')]) == [3, 'ab']
+        assert add.js_starmap([]) == []
+
+    def test_map_stops_on_error(self):
+        c = dukpy.Context()
+
+        check = c.evaljs("(function(x) { if (x > 1) { throw new Error('too big'); } return x; })")
+        try:
+            check.js_map([0, 1, 2, 3])
+            assert False
+        except dukpy.JSRuntimeError as e:
+            assert 'too big' in str(e)
+        assert check.js_map([1]) == [1]
+
+    def test_helpers_dont_hide_properties(self):
+        c = dukpy.Context()
+
+        obj = c.evaljs("({items: [1], keys: 'k', values: 'v', get_many: 'g', update: 'u'})")
+        assert list(obj.items) == [1]
+        assert (obj.keys, obj.values, obj.get_many, obj.update) == ('k', 'v', 'g', 'u')
+        arr = c.evaljs("[1, 2, 3]")
+        assert list(arr.map(c.evaljs("(function(x) { return x * 2; })"))) == [2, 4, 6]
+
     def test_can_return_obj(self):
         c = dukpy.Context()
 
         obj = c.evaljs("({'hi': 'mum'})")
         assert obj['hi'] == 'mum'
 
+    def test_get_many_and_update(self):
+        c = dukpy.Context()
+
+        obj = c.evaljs("({'a': 1, 'b': 'two', 'c': {'d': true}, 'f': function() { return this.a; }})")
+        a, b, missing = obj.js_get_many(['a', 'b', 'missing'])
+        assert (a, b, missing) == (1, 'two', None)
+        first, second = obj.js_get_many(['c', 'c'])
+        assert first is second
+        values = obj.js_get_many(['c', 'f'], as_dict=True)
+        assert values['c']['d'] is True
+        assert values['f']() == 1
+
+        obj.js_update({'a': 5, 'list': [1, 2]}, b='three')
+        assert c.evaljs("dukpy.o.a + dukpy.o.b + dukpy.o.list.length", o=obj) == '5three2'
+
+    def test_can_iterate_over_js(self):
+        c = dukpy.Context()
+
+        arr = c.evaljs("var a = []; for (var i = 0; i < 2500; i++) { a.push(i); } a")
+        assert list(arr) == list(range(2500))
+        assert list(arr.js_values(chunk_size=7))[-3:] == [2497, 2498, 2499]
+        assert list(c.evaljs("[]")) == []
+
+        obj = c.evaljs("var o = {'b': 1, 'a': {'x': 2}}; o.self = o; Object.defineProperty(o, 'hidden', {value: 3}); o")
+        assert list(obj) == ['b', 'a', 'self']
+        assert obj.js_keys() == ['b', 'a', 'self']
+        items = list(obj.js_items(chunk_size=2))
+        assert [k for k, _ in items] == ['b', 'a', 'self']
+        assert items[1][1]['x'] == 2
+        assert list(obj.js_values())[0] == 1
+
     def test_can_return_complex_obj(self):
         c = dukpy.Context()
 
@@ -237,10 +752,264 @@ class TestPythonToJSObject(object):
 class TestRequirableContext(object):
     test_js_dir = os.path.join(os.path.dirname(__file__), 'testjs')
 
+    @contextlib.contextmanager
+    def module_tree(self, files):
+        """Writes ``files``, relative path to source, under a temporary
+        directory which is removed afterwards. Sources that aren't strings
+        are written as JSON."""
+        import shutil, tempfile
+        root = tempfile.mkdtemp()
+        try:
+            for name, source in files.items():
+                path = os.path.join(root, *name.split('/'))
+                if not os.path.isdir(os.path.dirname(path)):
+                    os.makedirs(os.path.dirname(path))
+                with open(path, 'w') as f:
+                    if isinstance(source, str):
+                        f.write(source)
+                    else:
+                        json.dump(source, f)
+            yield root
+        finally:
+            shutil.rmtree(root)
+
     def test_js_require(self):
         c = dukpy.RequirableContext([self.test_js_dir])
         assert c.evaljs("require('testjs').call()") == "Hello from JS!"
 
+    def test_resolution_cache(self):
+        with self.module_tree({
+            'node_modules/pkg/package.json': {'main': 'lib/main'},
+            'node_modules/pkg/lib/main.js': "exports.name = 'pkg';",
+        }) as root:
+            pkg = os.path.join(root, 'node_modules', 'pkg')
+            cache = dukpy.ResolutionCache()
+            paths = [os.path.join(root, 'node_modules'), os.path.join(root, 'empty')]
+            c = dukpy.RequirableContext(paths, resolution_cache=cache)
+            assert c.evaljs("require('pkg').name") == 'pkg'
+            assert cache.stats()['misses'] == 1
+
+            # a fresh context resolves from the cache, missing modules are
+            # looked up again unless asked not to
+            trusting = dukpy.ResolutionCache(validate_missing=False)
+            assert dukpy.RequirableContext(paths, resolution_cache=trusting).evaljs("require('pkg').name") == 'pkg'
+            os.remove(os.path.join(pkg, 'package.json'))
+            for _ in range(2):
+                for resolution_cache in (cache, trusting):
+                    c = dukpy.RequirableContext(paths, resolution_cache=resolution_cache)
+                    assert c.evaljs("require('pkg').name") == 'pkg'
+                    try:
+                        c.evaljs("require('missing')")
+                        assert False
+                    except ImportError:
+                        pass
+            assert cache.stats()['hits'] == 2
+            assert trusting.stats()['hits'] == 3
+
+            with open(os.path.join(root, 'node_modules', 'missing.js'), 'w') as f:
+                f.write("exports.name = 'found';")
+            c = dukpy.RequirableContext(paths, resolution_cache=cache)
+            assert c.evaljs("require('missing').name") == 'found'
+            c = dukpy.RequirableContext(paths, resolution_cache=trusting)
+            try:
+                c.evaljs("require('missing')")
+                assert False
+            except ImportError:
+                pass
+
+            validating = dukpy.ResolutionCache(validate=True)
+            c = dukpy.RequirableContext(paths, resolution_cache=validating)
+            try:
+                c.evaljs("require('pkg')")
+                assert False
+            except ImportError:
+                pass
+
+    def test_resolution_order(self):
+        with self.module_tree({
+            'first/dep.js': "exports.name = 'first';",
+            'second/dep.js': "exports.name = 'second';",
+            'second/only.js': "exports.name = 'second only';",
+            'app/node_modules/dep.js': "exports.name = 'app';",
+            'app/lib/node_modules/dep.js': "exports.name = 'lib';",
+            'app/lib/main.js': "exports.dep = require('dep').name;",
+            'app/other/main.js': "exports.dep = require('dep').name;",
+        }) as root:
+            paths = [os.path.join(root, 'first'), os.path.join(root, 'second')]
+            c = dukpy.RequirableContext(paths, resolution_cache=dukpy.ResolutionCache())
+            # the first search path with the module wins
+            assert c.evaljs("require('dep').name") == 'first'
+            assert c.evaljs("require('only').name") == 'second only'
+            # the module's own node_modules come first, then the ones above it
+            assert c.evaljs("require('%s').dep" % os.path.join(root, 'app', 'lib', 'main')) == 'lib'
+            assert c.evaljs("require('%s').dep" % os.path.join(root, 'app', 'other', 'main')) == 'app'
+
+    def test_module_cache(self):
+        with self.module_tree({
+            'lib/main.js': "var data = require('./data'); exports.answer = function() { return data.answer; };",
+            'lib/data.json': {'answer': 42},
+        }) as root:
+            lib = os.path.join(root, 'lib')
+
+            def answer(cache):
+                c = dukpy.RequirableContext([lib], resolution_cache=dukpy.ResolutionCache(validate=True),
+                                            module_cache=cache)
+                return c.evaljs("require('main').answer()")
+
+            cache_dir = os.path.join(root, 'cache')
+            cache = dukpy.ModuleCache(cache_dir)
+            assert answer(cache) == 42
+            assert answer(cache) == 42
+            assert cache.stats()['misses'] == 2
+            assert cache.stats()['hits'] == 2
+
+            # another process would find the bytecode on disk
+            cache = dukpy.ModuleCache(cache_dir)
+            assert answer(cache) == 42
+            assert cache.stats()['misses'] == 0
+
+            # and skips over anything that doesn't look right
+            for name in os.listdir(cache_dir):
+                with open(os.path.join(cache_dir, name), 'r+b') as f:
+                    f.seek(-1, 2)
+                    f.write(b'?')
+            cache = dukpy.ModuleCache(cache_dir)
+            assert answer(cache) == 42
+            assert cache.stats()['misses'] == 2
+
+            with open(os.path.join(lib, 'data.json'), 'w') as f:
+                json.dump({'answer': 'forty two'}, f)
+            assert answer(cache) == 'forty two'
+
+    def test_module_archive(self):
+        import shutil
+        from dukpy.archive import pack, ModuleArchive
+        with self.module_tree({
+            'node_modules/pkg/package.json': {'main': './lib/main'},
+            'node_modules/pkg/lib/main.js': "var dep = require('dep'); exports.name = 'pkg ' + dep.name + require('./data').n;",
+            'node_modules/pkg/lib/data.json': {'n': 1},
+            'node_modules/pkg/lib/node_modules/dep/index.js': "exports.name = 'dep';",
+        }) as root:
+
+            for bytecode in (False, True):
+                path = os.path.join(root, 'modules%d.dka' % bytecode)
+                assert pack(os.path.join(root, 'node_modules'), path, bytecode=bytecode) == 4
+                archive = ModuleArchive(path)
+                for _ in range(2):
+                    c = dukpy.RequirableContext(archive=archive)
+                    assert c.evaljs("require('pkg').name") == 'pkg dep1'
+                assert archive.stats()['misses'] == (0 if bytecode else 3)
+                assert archive.stats()['hits'] == (6 if bytecode else 3)
+
+            # nothing is read from disk once the archive is open
+            shutil.rmtree(os.path.join(root, 'node_modules'))
+            c = dukpy.RequirableContext(archive=path)
+            assert c.evaljs("require('pkg').name") == 'pkg dep1'
+
+            # damaged bytecode is noticed and the source compiled instead
+            import struct
+            with open(path, 'rb') as f:
+                data = bytearray(f.read())
+            index_length, = struct.unpack('<I', bytes(data[8:12]))
+            index = json.loads(bytes(data[12:12 + index_length]).decode('utf-8'))
+            for entry in index['files'].values():
+                if entry[3]:
+                    start = 12 + index_length + entry[2]
+                    data[start:start + entry[3]] = b'\xff' * entry[3]
+            damaged = os.path.join(root, 'damaged.dka')
+            with open(damaged, 'wb') as f:
+                f.write(bytes(data))
+            archive = ModuleArchive(damaged)
+            c = dukpy.RequirableContext(archive=archive)
+            assert c.evaljs("require('pkg').name") == 'pkg dep1'
+            assert archive.stats()['corrupt'] == 3
+            assert archive.stats()['misses'] == 3
+
+    def test_native_require(self):
+        with self.module_tree({
+            'a/index.js': "exports.util = require('./util').name; exports.b = require('b').name;",
+            'a/util.js': "exports.name = 'a util';",
+            'b/index.js': "exports.name = 'b ' + require('./util').name;",
+            'b/util.js': "exports.name = 'b util';",
+            'cycle/one.js': "exports.early = 1; var two = require('./two'); exports.two = two.seen;",
+            'cycle/two.js': "exports.seen = require('./one').early;",
+            'broken.js': "if (typeof ready === 'undefined') { throw new Error('not yet'); } exports.ok = true;",
+        }) as root:
+            c = dukpy.RequirableContext([root], resolution_cache=dukpy.ResolutionCache(),
+                                        module_cache=dukpy.ModuleCache())
+            calls = []
+            load = c.finder.load
+
+            def counting_load(*args):
+                calls.append(args[2])
+                return load(*args)
+            dukpy._dukpy.ctx_install_require(c._ctx, counting_load)
+
+            # modules with the same relative ids don't get mixed up
+            assert list(c.evaljs("var a = require('a'); [a.util, a.b]")) == ['a util', 'b b util']
+            assert c.evaljs("require('b').name + require('a').util") == 'b b utila util'
+            # 'b' from global code is resolved once more, but not loaded again
+            assert calls == ['a', './util', 'b', './util', 'b']
+            assert c.evaljs("typeof Duktape.resolverBase + typeof _dukpy_last_module") == 'undefinedundefined'
+
+            assert c.evaljs("require('cycle/one').two") == 1
+
+            # failed modules are tried again
+            try:
+                c.evaljs("require('broken')")
+                assert False
+            except dukpy.JSRuntimeError:
+                pass
+            assert c.evaljs("ready = true; require('broken').ok") is True
+
+    def test_native_require_loader_failures(self):
+        c = dukpy.RequirableContext([])
+        module = c.evaljs("(function(require, exports, module) { exports.sibling = require('./sibling').name; })")
+        sibling = c.evaljs("(function(require, exports, module) { exports.name = 'sibling'; })")
+        calls = []
+
+        def load(pyctx, base, id_):
+            calls.append((base, id_))
+            if id_ == 'root':
+                # not a compiled function the first time
+                return '/root.js', (module if len(calls) > 1 else 'nope'), None
+            return '/sibling.js', sibling, None
+        dukpy._dukpy.ctx_install_require(c._ctx, load)
+
+        try:
+            c.evaljs("require('root')")
+            assert False
+        except dukpy.JSRuntimeError:
+            pass
+        # the failed load left nothing behind, and the root directory is "/"
+        assert c.evaljs("require('root').sibling") == 'sibling'
+        assert calls == [(None, 'root'), (None, 'root'), ('/', './sibling')]
+
+    def test_module_graph(self):
+        with self.module_tree({
+            'app/index.js': "exports.name = 'app ' + require('./util').name + ' ' + require('lib').name;",
+            'app/util.js': "exports.name = 'util';",
+            'lib/index.js': "exports.name = 'lib';",
+        }) as root:
+            c = dukpy.RequirableContext([root], module_cache=dukpy.ModuleCache())
+            assert c.evaljs("require('app').name") == 'app util lib'
+            graph = c.module_graph()
+            assert [m[1] for m in graph] == ['app', './util', 'lib']
+            assert graph.modules[1] == (os.path.join(root, 'app'), './util', os.path.join(root, 'app', 'util.js'))
+
+            graph_file = os.path.join(root, 'graph.json')
+            graph.save(graph_file)
+            graph = dukpy.ModuleGraph.load(graph_file)
+
+            # everything is compiled up front, requiring only loads bytecode
+            for threads in (0, 4):
+                cache = dukpy.ModuleCache()
+                c = dukpy.RequirableContext([root], module_cache=cache, preload=graph, preload_threads=threads)
+                assert cache.stats()['prepared'] == 3
+                assert c.evaljs("require('app').name") == 'app util lib'
+                assert cache.stats()['misses'] == 0
+                assert cache.stats()['hits'] == 3
+
     def test_python_require(self):
         import sys, imp
         testpy = imp.new_module('testpy')
@@ -250,6 +1019,38 @@ class TestRequirableContext(object):
         c = dukpy.RequirableContext([], enable_python=True)
         assert c.evaljs("require('python/testpy').call()") == "Hello from Python!"
 
+    def test_python_require_is_lazy(self):
+        import sys
+
+        class LazyModule(object):
+            __all__ = ['call', 'broken']
+            accessed = []
+
+            def __getattribute__(self, name):
+                if not name.startswith('__'):
+                    LazyModule.accessed.append(name)
+                if name == 'broken':
+                    raise AttributeError('broken')
+                return object.__getattribute__(self, name)
+
+            def call(self):
+                return 'lazy'
+
+            def hidden(self):
+                return 'hidden'
+
+        sys.modules['testlazy'] = LazyModule()
+        c = dukpy.RequirableContext([], enable_python=True)
+        c.evaljs("var m = require('python/testlazy');")
+        assert LazyModule.accessed == []
+        assert c.evaljs("m.call()") == 'lazy'
+        assert LazyModule.accessed == ['call']
+        assert list(c.evaljs("[typeof m.hidden, 'call' in m, 'hidden' in m]")) == ['undefined', True, False]
+        assert list(c.evaljs("[typeof m._module, typeof m.keys, typeof m.__class__, 'keys' in m]")) == \
+            ['undefined', 'undefined', 'undefined', False]
+        assert list(c.evaljs("var names = []; for (var name in m) { names.push(name); } names")) == ['broken', 'call']
+        assert list(c.evaljs("Object.keys(m)")) == ['broken', 'call']
+
     def test_python_require_doesnt_work_by_default(self):
         import sys, imp
         testpy = imp.new_module('testpy')
@@ -263,6 +1064,54 @@ class TestRequirableContext(object):
         except ImportError:
             pass
 
+    def test_process_env(self):
+        os.environ['DUKPY_TEST_ENV'] = 'before'
+        os.environ['DUKPY_TEST_OTHER'] = 'other'
+        try:
+            c = dukpy.RequirableContext([])
+            assert c.evaljs("process.env.DUKPY_TEST_ENV") == 'before'
+            # reads are live, not a snapshot taken when the context was made
+            os.environ['DUKPY_TEST_ENV'] = 'after'
+            assert c.evaljs("process.env.DUKPY_TEST_ENV") == 'after'
+            assert c.evaljs("'DUKPY_TEST_ENV' in process.env") is True
+            assert c.evaljs("Object.keys(process.env).indexOf('DUKPY_TEST_ENV') >= 0") is True
+            assert c.evaljs("process.env.DUKPY_TEST_MISSING") is None
+            # assignments stay in the context
+            c.evaljs("process.env.DUKPY_TEST_ENV = 3")
+            assert c.evaljs("process.env.DUKPY_TEST_ENV") == '3'
+            assert os.environ['DUKPY_TEST_ENV'] == 'after'
+            # deleting hides the variable, until it's set again
+            c.evaljs("delete process.env.DUKPY_TEST_OTHER; delete process.env.DUKPY_TEST_ENV")
+            assert c.evaljs("process.env.DUKPY_TEST_OTHER") is None
+            assert c.evaljs("'DUKPY_TEST_OTHER' in process.env") is False
+            assert c.evaljs("Object.keys(process.env).indexOf('DUKPY_TEST_OTHER')") == -1
+            c.evaljs("process.env.DUKPY_TEST_OTHER = 'again'")
+            assert c.evaljs("process.env.DUKPY_TEST_OTHER") == 'again'
+            assert os.environ['DUKPY_TEST_OTHER'] == 'other'
+
+            c = dukpy.RequirableContext([], env_whitelist=['DUKPY_TEST_ENV'])
+            assert c.evaljs("process.env.DUKPY_TEST_ENV") == 'after'
+            assert c.evaljs("process.env.DUKPY_TEST_OTHER") is None
+            assert c.evaljs("'DUKPY_TEST_OTHER' in process.env") is False
+            assert list(c.evaljs("Object.keys(process.env)")) == ['DUKPY_TEST_ENV']
+        finally:
+            del os.environ['DUKPY_TEST_ENV']
+            del os.environ['DUKPY_TEST_OTHER']
+
+    def test_process_env_decodes_like_os_environ(self):
+        environb = getattr(os, 'environb', None)
+        if environb is None:
+            raise SkipTest('os.environ holds bytes')
+        environb[b'DUKPY_TEST_BYTES'] = b'caf\xc3\xa9 caf\xe9'
+        try:
+            c = dukpy.RequirableContext([])
+            expected = os.environ['DUKPY_TEST_BYTES']
+            codes = c.evaljs("var v = process.env.DUKPY_TEST_BYTES, codes = [];"
+                             "for (var i = 0; i < v.length; i++) { codes.push(v.charCodeAt(i)); } codes.join(',')")
+            assert codes == ','.join(str(ord(ch)) for ch in expected)
+        finally:
+            del environb[b'DUKPY_TEST_BYTES']
+
 
 class TestRegressions(object):
     def test_pyargs_segfault(self):